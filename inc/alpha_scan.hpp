@@ -0,0 +1,54 @@
+#ifndef C7E2A4D1_9B3F_4E58_A6D0_2F81B5C3E947
+#define C7E2A4D1_9B3F_4E58_A6D0_2F81B5C3E947
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Row scanner that looks for pixels whose alpha is above a threshold.
+// Interleaved RGBA rows are tested 16/32/64 pixels at a time (SSE2/AVX2/AVX-512), alpha planes (stride 1) 64 pixels at a time.
+// Every other layout goes through the scalar reference.
+class alpha_scan
+{
+  public:
+	using find_fn = int32_t (*)(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold);
+
+	// Both searches for interleaved RGBA rows and for alpha planes, built for one instruction set
+	struct kernel
+	{
+		find_fn first;
+		find_fn last;
+		find_fn plane_first;
+		find_fn plane_last;
+		const char* name;
+	};
+
+	alpha_scan(size_t in_stride, size_t in_offset, uint8_t in_threshold = 0);
+
+	// Index of the first pixel in [in_begin, in_end) with alpha above the threshold, -1 if there is none
+	[[nodiscard]] auto find_first(const uint8_t* ptr_row, int32_t in_begin, int32_t in_end) const -> int32_t;
+
+	// Index of the last pixel in [in_begin, in_end) with alpha above the threshold, -1 if there is none
+	[[nodiscard]] auto find_last(const uint8_t* ptr_row, int32_t in_begin, int32_t in_end) const -> int32_t;
+
+	[[nodiscard]] auto is_opaque(const uint8_t* ptr_row, int32_t in_x) const -> bool { return ptr_row[static_cast<size_t>(in_x) * m_stride + m_offset] > m_threshold; }
+
+	// Name of the instruction set picked for RGBA rows and alpha planes on this machine
+	[[nodiscard]] static auto get_isa_name() -> const char*;
+
+	// Every kernel built in that this machine runs, not just the widest one the scanners pick
+	[[nodiscard]] static auto get_supported_kernels() -> std::vector<kernel>;
+
+	// Pixel by pixel reference every other kernel has to agree with
+	[[nodiscard]] static auto get_scalar_kernel() -> kernel;
+
+  private:
+	size_t m_stride;
+	size_t m_offset;
+	uint8_t m_threshold;
+
+	find_fn m_find_first;
+	find_fn m_find_last;
+};
+
+#endif /* C7E2A4D1_9B3F_4E58_A6D0_2F81B5C3E947 */
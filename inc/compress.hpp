@@ -1,23 +1,51 @@
 #ifndef B15BF9B5_6F86_48C7_AB2D_35B8FD21054B
 #define B15BF9B5_6F86_48C7_AB2D_35B8FD21054B
 
-#include <cassert>
-#include <format>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <string_view>
-#include <stdexcept>
+#include <vector>
 
-static auto compress_png(const std::string_view& file_path) -> void
+enum class compress_status : uint8_t
 {
-	std::string cmd = std::format(" pngquant --ext .png --force --strip --skip-if-larger {}", file_path);
-	if (std::system(cmd.c_str()) != 0)
-	{
-		throw std::runtime_error("Failed to compress PNG file.");
-	}
-}
-
-static auto compress_jpeg(const std::string_view& file_path) -> void
+	compressed,
+	// The compressed file would have been larger, the original is left alone
+	skipped,
+	failed
+};
+
+struct compress_result
+{
+	std::string file_path;
+	compress_status status;
+	// What the compressor printed when it failed
+	std::string message;
+};
+
+// Runs pngquant through posix_spawn without a shell, either on many files per process or on one encoded PNG piped through stdin and stdout.
+// Each call blocks on one process, the callers bound the concurrency by running it from pool tasks.
+// The process has to ignore SIGPIPE before compress_buffer is used, a compressor that exits without reading all of stdin would kill it otherwise.
+class pngquant_runner
 {
-	assert(false && "JPEG compression is not implemented yet.");
-}
+  public:
+	explicit pngquant_runner(size_t in_batch_size = 16);
+
+	// Compresses the files in place with one process, a failed batch is retried one file at a time so every path gets its own result
+	[[nodiscard]] auto compress_files(const std::vector<std::string>& in_file_paths) const -> std::vector<compress_result>;
+
+	// out_png is only filled when the status is compressed
+	[[nodiscard]] auto compress_buffer(const std::vector<uint8_t>& in_png, std::vector<uint8_t>& out_png, std::string& out_message) const -> compress_status;
+
+	[[nodiscard]] auto get_batch_size() const -> size_t { return m_batch_size; }
+
+  private:
+	size_t m_batch_size;
+};
+
+// Compresses one file in place, throws unless it was compressed or skipped as larger
+auto compress_png(const std::string_view& file_path) -> void;
+// Rewrites the file losslessly as progressive with optimized Huffman tables when that is smaller, throws if it cannot be read or written
+auto compress_jpeg(const std::string_view& file_path) -> void;
 
 #endif /* B15BF9B5_6F86_48C7_AB2D_35B8FD21054B */
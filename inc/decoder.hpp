@@ -0,0 +1,90 @@
+#ifndef E7A2C4D1_9F36_4B8E_A0C5_5D14B8F3E627
+#define E7A2C4D1_9F36_4B8E_A0C5_5D14B8F3E627
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class image_format : uint8_t
+{
+	unknown,
+	png,
+	jpeg,
+	qoi,
+	webp
+};
+
+enum class image_decoder : uint8_t
+{
+	stb,
+	// png_reader, the whole image through the fast inflater
+	png_rows,
+	libjpeg,
+	qoi,
+	webp
+};
+
+constexpr size_t image_decoder_count = 5;
+
+// What every backend decodes into, 8-bit channels interleaved row after row, so the scanners and the crop never see which backend ran
+struct pixel_buffer
+{
+	int32_t width;
+	int32_t height;
+	size_t channels;
+	std::vector<uint8_t> pixels;
+	// One flag per row that is known to be all zero without looking at its pixels, empty when the backend cannot tell
+	std::vector<uint8_t> clear_rows;
+};
+
+struct image_header
+{
+	int32_t width;
+	int32_t height;
+	size_t channels;
+};
+
+// Totals of one decoder, seconds are summed over the threads that decoded
+struct decode_stats
+{
+	size_t files;
+	size_t bytes;
+	double seconds;
+};
+
+// Picks the backend that decodes a file from its magic bytes, the extension is never looked at.
+// Backends chosen with --decoder go first for every format they read, the others keep the default order, fastest first.
+class decoder_registry
+{
+  public:
+	[[nodiscard]] static auto sniff(const std::string& in_file_path) -> image_format;
+
+	// Whether in_decoder is compiled in and reads in_format
+	[[nodiscard]] static auto supports(image_decoder in_decoder, image_format in_format) -> bool;
+	// Whether any compiled in backend reads in_format
+	[[nodiscard]] static auto can_decode(image_format in_format) -> bool;
+
+	// Size and channel count without decoding, the channels are what decode reports for the file
+	[[nodiscard]] static auto read_header(const std::string& in_file_path, image_format in_format) -> image_header;
+	// in_channels of 0 keeps the channels of the file, anything else converts to that many
+	[[nodiscard]] static auto decode(const std::string& in_file_path, image_decoder in_decoder, size_t in_channels = 0) -> pixel_buffer;
+
+	// in_bytes is what the decoder produced, not what the caller kept of it
+	static auto record_decode(image_decoder in_decoder, size_t in_bytes, std::chrono::steady_clock::time_point in_start) -> void;
+	[[nodiscard]] static auto get_decode_stats(image_decoder in_decoder) -> decode_stats;
+
+	[[nodiscard]] static auto get_decoder_name(image_decoder in_decoder) -> const char*;
+	[[nodiscard]] static auto get_format_name(image_format in_format) -> const char*;
+
+	// Backends that are not compiled in are skipped with a warning
+	auto prefer(image_decoder in_decoder) -> void;
+	// The first preferred backend that reads in_format, otherwise the default for it
+	[[nodiscard]] auto select(image_format in_format) const -> image_decoder;
+
+  private:
+	std::vector<image_decoder> m_preferred;
+};
+
+#endif /* E7A2C4D1_9F36_4B8E_A0C5_5D14B8F3E627 */
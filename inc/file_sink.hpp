@@ -0,0 +1,39 @@
+#ifndef D4A7E1C9_52B8_4F3A_9E06_7C1B3F8A2D54
+#define D4A7E1C9_52B8_4F3A_9E06_7C1B3F8A2D54
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Streams into a temporary file next to the target and renames it over the original once close succeeds.
+// An encode that throws or a disk that fills up mid-stream leaves the original untouched, the temporary is removed on destruction.
+// Every writer goes through it, whatever the format.
+class file_sink
+{
+  public:
+	explicit file_sink(std::string in_file_path);
+	~file_sink();
+
+	file_sink(const file_sink&)					   = delete;
+	file_sink(file_sink&&)						   = delete;
+	auto operator=(const file_sink&) -> file_sink& = delete;
+
+	auto append(const uint8_t* ptr_data, size_t in_size) -> void;
+
+	// Replaces the original with what was appended, keeping its permissions, returns the bytes written, throws if the file cannot be written
+	auto close() -> size_t;
+
+  private:
+	std::string m_file_path;
+	std::string m_temp_path;
+	std::ofstream m_file;
+	size_t m_written{};
+	bool m_is_committed{false};
+};
+
+// Writes in_data in one go through a file_sink, returns the bytes written
+auto save_file(const std::string& in_file_path, const std::vector<uint8_t>& in_data) -> size_t;
+
+#endif /* D4A7E1C9_52B8_4F3A_9E06_7C1B3F8A2D54 */
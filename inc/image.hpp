@@ -6,8 +6,19 @@
 #include <string>
 #include <vector>
 
+#include "alpha_scan.hpp"
+#include "decoder.hpp"
+#include "jpeg.hpp"
+#include "png_writer.hpp"
 #include "rect.hpp"
 
+// 4-connected group of opaque pixels
+struct component
+{
+	rect bounds;
+	size_t pixel_count;
+};
+
 class image
 {
   private:
@@ -15,14 +26,36 @@ class image
 	rect m_trim_rect;
 
 	std::string m_file_path;
-	std::string m_extension;
 
 	size_t m_channels;
 	std::vector<uint8_t> m_data;
 
+	bool m_is_scanned{false};
+	bool m_is_streamable{false};
+	// Stored with colour type 3, quantizing it again cannot win anything
+	bool m_is_paletted{false};
+	image_format m_format{image_format::unknown};
+	image_decoder m_decoder{image_decoder::stb};
+	// m_data holds one alpha byte per pixel instead of every channel
+	bool m_is_alpha_plane{false};
+	// Rows the PNG decoder saw as all zero straight out of inflate, the scanners skip them, empty for the other backends
+	std::vector<uint8_t> m_clear_rows;
+
+	auto copy_crop_row(const uint8_t* ptr_src_row, const rect& in_rect, uint8_t* ptr_dst_row) const -> void;
 	auto write_data(std::vector<uint8_t>& out_data, const rect& in_rect) -> void;
+	auto stream_data(std::vector<uint8_t>& out_data, const rect& in_rect) -> void;
 	auto flood_fill() -> rect;
 	auto std_algo() -> rect;
+	auto edge_inward() -> rect;
+	auto island_algo(size_t in_min_island) -> rect;
+
+	[[nodiscard]] auto has_alpha() const -> bool { return m_channels == 2 || m_channels == 4; }
+	[[nodiscard]] auto get_pixel_size() const -> size_t { return m_is_alpha_plane ? 1 : m_channels; }
+	[[nodiscard]] auto get_reader_size() const -> size_t;
+	[[nodiscard]] auto get_alpha_scan() const -> alpha_scan;
+	[[nodiscard]] auto get_row(int32_t in_y) const -> const uint8_t*;
+	[[nodiscard]] auto is_clear_row(int32_t in_y) const -> bool { return !m_clear_rows.empty() && m_clear_rows[static_cast<size_t>(in_y)] != 0; }
+	[[nodiscard]] auto uses_libjpeg() const -> bool { return m_decoder == image_decoder::libjpeg; }
 
   public:
 	image(const std::string_view& file_path);
@@ -31,18 +64,62 @@ class image
 	image(image&&)						   = delete;
 	auto operator=(const image&) -> image& = delete;
 
-	auto rewrite_with_new_rect(const rect& new_rect) -> void;
+	// Decodes the pixels, the constructor only reads the header
+	auto load() -> void;
+	// Decodes only the alpha channel into a plane of one byte per pixel, enough for every bounding box algorithm but not for the trim
+	auto load_alpha() -> void;
+	// Frees the pixels, the header and the bounding box stay available
+	auto release() -> void;
+
+	// Every format is written back as itself, JPEGs through in_jpeg_writer, QOI losslessly, WebP lossy or lossless like its source and PNGs through in_writer
+	auto rewrite_with_new_rect(const rect& new_rect, png_writer& in_writer, jpeg_writer& in_jpeg_writer) -> void;
 
 	auto perform_compresion() -> void;
+	// In-process alternative to perform_compresion, the file is only replaced if the indexed encoding is smaller
+	auto quantize(png_writer& in_writer) -> void;
+	// Decodes the file if needed and asks the writer whether quantizing it is worth it, for compressors that work on the file itself
+	auto precheck(png_writer& in_writer) -> bool;
+
+	auto get_image_boundings(uint8_t idx_algorithm, size_t in_min_island = 0) -> rect;
+	// Keeps a result found outside get_image_boundings, such as the union of row tiles, later calls return it without reading the pixels
+	auto set_image_boundings(const rect& in_rect) -> void
+	{
+		m_trim_rect	 = in_rect;
+		m_is_scanned = true;
+	}
+
+	// Every 4-connected component with its bounds and pixel count
+	[[nodiscard]] auto label_components() const -> std::vector<component>;
 
-	auto get_image_boundings(uint8_t idx_algorithm) -> rect;
+	// Union of in_union and the opaque pixels in rows [in_y_begin, in_y_end), pixels inside in_union are never read
+	auto grow_boundings(const rect& in_union, int32_t in_y_begin = 0, int32_t in_y_end = -1) -> rect;
 
 	[[nodiscard]] auto get_data() const -> const uint8_t* { return m_data.data(); }
 	[[nodiscard]] auto get_rect() const -> const rect& { return m_rect; }
+	[[nodiscard]] auto get_trim_rect() const -> const rect& { return m_trim_rect; }
+	[[nodiscard]] auto get_channels() const -> size_t { return m_channels; }
+	[[nodiscard]] auto get_decoded_size() const -> size_t { return static_cast<size_t>(m_rect.get_width()) * static_cast<size_t>(m_rect.get_height()) * m_channels; }
+	// Peak bytes held while decoding, the decoder output and its copy in m_data
+	[[nodiscard]] auto get_load_size() const -> size_t { return get_decoded_size() * 2; }
+	// Bytes of the alpha plane, images without alpha keep none
+	[[nodiscard]] auto get_plane_size() const -> size_t { return has_alpha() ? static_cast<size_t>(m_rect.get_width()) * static_cast<size_t>(m_rect.get_height()) : 0; }
+	// Peak bytes held while decoding the alpha plane
+	[[nodiscard]] auto get_plane_load_size() const -> size_t;
+	// Peak bytes held while trimming an image that is not resident
+	[[nodiscard]] auto get_trim_size(const rect& in_rect) const -> size_t;
+	[[nodiscard]] auto is_loaded() const -> bool { return !m_data.empty() && !m_is_alpha_plane; }
+	[[nodiscard]] auto is_scanned() const -> bool { return m_is_scanned; }
+	[[nodiscard]] auto is_paletted() const -> bool { return m_is_paletted; }
+	[[nodiscard]] auto is_jpeg() const -> bool { return m_format == image_format::jpeg; }
+	// Without alpha the scan reads no pixels and the trim decodes only its crop, keeping the image resident buys nothing
+	[[nodiscard]] auto prefers_crop_decode() const -> bool { return uses_libjpeg() && !has_alpha(); }
 	[[nodiscard]] auto get_file_path() const -> const std::string& { return m_file_path; }
-	[[nodiscard]] auto get_extension() const -> std::string { return m_extension; }
+	[[nodiscard]] auto get_format() const -> image_format { return m_format; }
+	[[nodiscard]] auto get_decoder() const -> image_decoder { return m_decoder; }
 
-	auto set_extension(const std::string_view& extension) -> void { m_extension = extension; }
+	// Backend of the full decodes, the row reader only handles a subset of PNGs and leaves the rest to stb.
+	// Streaming the rows of a PNG always goes through the row reader, it is what keeps the memory down.
+	auto set_decoder(image_decoder in_decoder) -> void { m_decoder = in_decoder == image_decoder::png_rows && !m_is_streamable ? image_decoder::stb : in_decoder; }
 };
 
 #endif /* AD314575_F224_47AC_B8F3_797A63D13BB7 */
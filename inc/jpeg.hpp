@@ -0,0 +1,93 @@
+#ifndef C4E19A07_8B3D_4F62_A5D1_36F0B7E2C958
+#define C4E19A07_8B3D_4F62_A5D1_36F0B7E2C958
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+#include "rect.hpp"
+
+// Pixels covered by one iMCU, 8 or 16 in each direction depending on the chroma subsampling
+struct mcu_size
+{
+	int32_t width;
+	int32_t height;
+};
+
+// JPEG decode and encode through libjpeg-turbo, whose SIMD IDCT and colour conversion do the heavy lifting.
+// Grey files decode to one channel and everything else to RGB, the same channel counts stb reports.
+// libjpeg reports errors by jumping out of the library, they surface here as std::runtime_error.
+class jpeg_codec
+{
+  public:
+	// Whether the file starts with the JPEG start of image marker
+	[[nodiscard]] static auto can_read(const std::string& in_file_path) -> bool;
+
+	[[nodiscard]] static auto decode(const std::string& in_file_path) -> pixel_buffer;
+
+	// Reads only the header
+	[[nodiscard]] static auto get_mcu_size(const std::string& in_file_path) -> mcu_size;
+
+	// Fills ptr_out with in_rect at in_channels, rows above it are skipped without the IDCT and rows below are never read.
+	// Only the iMCU columns around the crop are decoded, parts of the crop outside the image are left alone.
+	static auto decode_crop(const std::string& in_file_path, const rect& in_rect, size_t in_channels, uint8_t* ptr_out) -> void;
+
+	// Optimized Huffman tables, baseline or progressive, the EXIF and ICC markers of the file at in_file_path are carried over when it exists
+	[[nodiscard]] static auto encode(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, int32_t in_quality,
+									 bool in_progressive) -> std::vector<uint8_t>;
+
+	// Lossless, the DCT coefficients are written again as progressive with optimized Huffman tables, only the EXIF and ICC markers are kept
+	[[nodiscard]] static auto optimize(const std::string& in_file_path) -> std::vector<uint8_t>;
+
+	// Lossless like jpegtran -crop, the offsets of in_rect snap down to the iMCU grid and the DCT blocks of the surviving iMCUs are copied without an IDCT.
+	// The far edges stay where they are, so the result covers in_rect plus up to one iMCU to the left and above. Empty if in_rect reaches past the image.
+	[[nodiscard]] static auto crop_lossless(const std::string& in_file_path, const rect& in_rect, bool in_progressive) -> std::vector<uint8_t>;
+};
+
+// Writes the trimmed JPEGs back as JPEG, shared by every trim task like png_writer, it also keeps the totals for the summary
+class jpeg_writer
+{
+  public:
+	explicit jpeg_writer(int32_t in_quality = 90);
+
+	jpeg_writer(const jpeg_writer&)					   = delete;
+	jpeg_writer(jpeg_writer&&)						   = delete;
+	auto operator=(const jpeg_writer&) -> jpeg_writer& = delete;
+
+	// Progressive scans are a few percent smaller and slower to decode, the compress pass asks for them
+	auto set_progressive(bool in_progressive) -> void { m_progressive = in_progressive; }
+	// Crops in the DCT domain instead of decoding and encoding again, see jpeg_codec::crop_lossless
+	auto set_lossless(bool in_lossless) -> void { m_lossless = in_lossless; }
+
+	// Writes 8-bit grey or RGB rows, throws if the file cannot be written
+	auto write(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> void;
+	// Lossless crop of the file in place, false if the crop reaches past the image and the pixels have to be re-encoded
+	auto write_cropped(const std::string& in_file_path, const rect& in_rect) -> bool;
+
+	[[nodiscard]] auto is_lossless() const -> bool { return m_lossless; }
+	// Peak bytes libjpeg holds on top of the crop, the lossless crop keeps every coefficient of the file which is about its decoded size
+	[[nodiscard]] auto get_working_size(size_t in_decoded_size) const -> size_t { return m_lossless ? in_decoded_size : 0; }
+
+	[[nodiscard]] auto get_quality() const -> int32_t { return m_quality; }
+	[[nodiscard]] auto get_files() const -> size_t { return m_files; }
+	[[nodiscard]] auto get_raw_bytes() const -> size_t { return m_raw_bytes; }
+	[[nodiscard]] auto get_encoded_bytes() const -> size_t { return m_encoded_bytes; }
+	[[nodiscard]] auto get_lossless_files() const -> size_t { return m_lossless_files; }
+	[[nodiscard]] auto get_lossless_bytes() const -> size_t { return m_lossless_bytes; }
+
+  private:
+	int32_t m_quality;
+	bool m_progressive{false};
+	bool m_lossless{false};
+
+	std::atomic<size_t> m_files{0};
+	std::atomic<size_t> m_raw_bytes{0};
+	std::atomic<size_t> m_encoded_bytes{0};
+	std::atomic<size_t> m_lossless_files{0};
+	std::atomic<size_t> m_lossless_bytes{0};
+};
+
+#endif /* C4E19A07_8B3D_4F62_A5D1_36F0B7E2C958 */
@@ -8,19 +8,39 @@
 
 // C++ Standard Library
 #include <algorithm>  // IWYU pragma: keep
+#include <array>	  // IWYU pragma: keep
+#include <atomic>	  // IWYU pragma: keep
+#include <chrono>	  // IWYU pragma: keep
+#include <csignal>	  // IWYU pragma: keep
 #include <cstddef>	  // IWYU pragma: keep
 #include <cstdint>	  // IWYU pragma: keep
 #include <filesystem> // IWYU pragma: keep
+#include <fstream>	  // IWYU pragma: keep
+#include <functional> // IWYU pragma: keep
+#include <map>		  // IWYU pragma: keep
 #include <regex>	  // IWYU pragma: keep
 #include <thread>	  // IWYU pragma: keep
 #include <future>	  // IWYU pragma: keep
+#include <mutex>	  // IWYU pragma: keep
+#include <numeric>	  // IWYU pragma: keep
+#include <unordered_map> // IWYU pragma: keep
 
 // Unix
-#include <fnmatch.h> // IWYU pragma: keep
+#include <fnmatch.h>	  // IWYU pragma: keep
+#include <sys/resource.h> // IWYU pragma: keep
+#include <unistd.h>		  // IWYU pragma: keep
 
 // Own
-#include "image.hpp"	// IWYU pragma: keep
-#include "compress.hpp" // IWYU pragma: keep
-#include "progress.hpp" // IWYU pragma: keep
+#include "image.hpp"		 // IWYU pragma: keep
+#include "compress.hpp"		 // IWYU pragma: keep
+#include "decoder.hpp"		 // IWYU pragma: keep
+#include "jpeg.hpp"			 // IWYU pragma: keep
+#include "memory_budget.hpp" // IWYU pragma: keep
+#include "png.hpp"			 // IWYU pragma: keep
+#include "png_writer.hpp"	 // IWYU pragma: keep
+#include "progress.hpp"		 // IWYU pragma: keep
+#include "quantizer.hpp"	 // IWYU pragma: keep
+#include "thread_pool.hpp"	 // IWYU pragma: keep
+#include "webp.hpp"			 // IWYU pragma: keep
 
 #endif /* F1523F66_3E89_4570_9720_5B4717481A7A */
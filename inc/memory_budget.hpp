@@ -0,0 +1,59 @@
+#ifndef E4A61B2C_7D35_4F0E_9C48_B3D2F6A17E05
+#define E4A61B2C_7D35_4F0E_9C48_B3D2F6A17E05
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Admission control for decode work, a limit of 0 admits everything
+class memory_budget
+{
+  public:
+	memory_budget() = default;
+
+	auto set_limit(size_t in_limit) -> void { m_limit = in_limit; }
+
+	[[nodiscard]] auto get_limit() const -> size_t { return m_limit; }
+	[[nodiscard]] auto get_peak() const -> size_t { return m_peak; }
+
+	// Blocks until in_bytes fit under the limit, requests are admitted in arrival order
+	// A request larger than the whole limit waits until nothing else is in flight and then runs alone
+	auto acquire(size_t in_bytes) -> void
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		const auto ticket = m_next_ticket++;
+		m_condition.wait(lock, [this, ticket, in_bytes]() { return ticket == m_serving && (m_limit == 0 || m_used == 0 || m_used + in_bytes <= m_limit); });
+
+		++m_serving;
+		m_used += in_bytes;
+		m_peak = std::max(m_peak, m_used);
+
+		m_condition.notify_all();
+	}
+
+	auto release(size_t in_bytes) -> void
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_used -= in_bytes;
+		}
+
+		m_condition.notify_all();
+	}
+
+  private:
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+
+	size_t m_limit{};
+	size_t m_used{};
+	size_t m_peak{};
+
+	uint64_t m_next_ticket{};
+	uint64_t m_serving{};
+};
+
+#endif /* E4A61B2C_7D35_4F0E_9C48_B3D2F6A17E05 */
@@ -0,0 +1,83 @@
+#ifndef D58B2E6F_41A7_4C93_B0E2_7F36C9A14D8B
+#define D58B2E6F_41A7_4C93_B0E2_7F36C9A14D8B
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "decoder.hpp"
+
+// Row by row PNG decoder, only the compressed input window and two scanlines are held at once.
+// Handles 8-bit non-interlaced grey, grey+alpha, RGB and RGBA without tRNS, i.e. the files stb decodes to the same channel count.
+class png_reader
+{
+  public:
+	explicit png_reader(const std::string& in_file_path);
+	~png_reader();
+
+	png_reader(const png_reader&)					 = delete;
+	png_reader(png_reader&&)						 = delete;
+	auto operator=(const png_reader&) -> png_reader& = delete;
+
+	// Whether the file is a PNG this reader can decode, only the chunks before the first IDAT are read
+	[[nodiscard]] static auto can_read(const std::string& in_file_path) -> bool;
+	// Whether the file is a PNG stored with colour type 3, only the signature and IHDR are read
+	[[nodiscard]] static auto is_paletted(const std::string& in_file_path) -> bool;
+
+	// Whole image at once, the IDAT chunks are inflated in one call and unfiltered in place, for when every row is wanted anyway.
+	// Inflates with libdeflate when its header is found at build time, zlib otherwise. Fills clear_rows of the result.
+	[[nodiscard]] static auto decode(const std::string& in_file_path) -> pixel_buffer;
+
+	// CRC checks of IHDR and the IDAT chunks, on by default, shared by every reader
+	static auto set_verify_crc(bool in_verify) -> void;
+	// libdeflate or zlib, whichever decode inflates with
+	[[nodiscard]] static auto get_inflater_name() -> const char*;
+
+	[[nodiscard]] auto get_width() const -> int32_t { return m_width; }
+	[[nodiscard]] auto get_height() const -> int32_t { return m_height; }
+	[[nodiscard]] auto get_channels() const -> size_t { return m_channels; }
+	[[nodiscard]] auto get_stride() const -> size_t { return static_cast<size_t>(m_width) * m_channels; }
+	[[nodiscard]] auto get_next_row() const -> int32_t { return m_next_row; }
+
+	// Inflates and unfilters the next row, the pointer stays valid until the following call
+	auto read_row() -> const uint8_t*;
+	// Whether the row last returned by read_row was all zero straight out of inflate and skipped the unfilter
+	[[nodiscard]] auto is_row_clear() const -> bool { return m_row_clear; }
+
+  private:
+	std::ifstream m_file;
+	std::string m_file_path;
+
+	int32_t m_width{};
+	int32_t m_height{};
+	size_t m_channels{};
+	int32_t m_next_row{};
+
+	z_stream m_stream{};
+	bool m_stream_ready{false};
+	bool m_stream_done{false};
+
+	uint32_t m_idat_left{};
+	// Running CRC of the IDAT chunk being read
+	uint32_t m_crc{};
+	std::vector<uint8_t> m_input;
+
+	// Filter byte followed by the row, the previous row is kept for the Up/Avg/Paeth filters
+	std::vector<uint8_t> m_row;
+	std::vector<uint8_t> m_prev_row;
+	// Starts out set for the implicit zero row above the first one
+	bool m_row_clear{true};
+
+	auto read_header() -> bool;
+	auto read_chunk_header(uint32_t& out_length, std::string& out_type) -> bool;
+	auto fill_input() -> void;
+	// Reads the CRC that follows the chunk data and compares it with m_crc
+	auto finish_chunk() -> void;
+	auto unfilter(uint8_t in_filter, uint8_t* ptr_row, const uint8_t* ptr_prev) const -> void;
+};
+
+#endif /* D58B2E6F_41A7_4C93_B0E2_7F36C9A14D8B */
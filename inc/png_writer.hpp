@@ -0,0 +1,144 @@
+#ifndef F3C81A5D_6E27_4B90_9D14_A8E0C57B2F36
+#define F3C81A5D_6E27_4B90_9D14_A8E0C57B2F36
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "quantizer.hpp"
+
+class pngquant_runner;
+class thread_pool;
+
+enum class png_encoder : uint8_t
+{
+	stb,
+	zlib
+};
+
+enum class png_effort : uint8_t
+{
+	fast,
+	balanced,
+	small
+};
+
+// PNG encoder shared by every trim task, it also keeps the totals for the summary.
+// The zlib backend picks a filter per row by the smallest sum of absolute residuals and streams IDAT chunks straight to the file.
+// Images of a few MB and up are cut into strips that deflate in parallel on the pool.
+// The optimize mode instead tries every filter and deflate strategy on the pool and keeps the smallest stream.
+// With a quantizer set every image is also encoded as an indexed PNG, and whichever file is smaller is written.
+// With pngquant set the encoded image is piped through it instead, nothing touches the disk before the final file.
+// With a byte budget an indexed encoding over it starts a search over the colour count, whose candidates encode in parallel in memory.
+class png_writer
+{
+  public:
+	using byte_sink = std::function<void(const uint8_t*, size_t)>;
+
+	png_writer(png_encoder in_encoder, png_effort in_effort, thread_pool* ptr_pool = nullptr);
+
+	png_writer(const png_writer&)					 = delete;
+	png_writer(png_writer&&)						 = delete;
+	auto operator=(const png_writer&) -> png_writer& = delete;
+
+	// Trades encode time for size, overrides the effort and only applies to the zlib backend
+	auto set_optimize(bool in_optimize) -> void { m_optimize = in_optimize; }
+
+	// Not owned, must outlive the writer
+	auto set_quantizer(const quantizer* ptr_quantizer) -> void { m_ptr_quantizer = ptr_quantizer; }
+	// Not owned, must outlive the writer, needs the quantizer for the remap
+	auto set_shared_palette(const palette* ptr_palette) -> void { m_ptr_shared_palette = ptr_palette; }
+	// Every frame is mapped to the shared palette, the pre-check has nothing to decide
+	[[nodiscard]] auto has_shared_palette() const -> bool { return m_ptr_shared_palette != nullptr; }
+	// Not owned, must outlive the writer, takes precedence over the quantizer
+	auto set_pngquant(const pngquant_runner* ptr_pngquant) -> void { m_ptr_pngquant = ptr_pngquant; }
+
+	// Byte budget of every file, 0 for none
+	auto set_max_bytes(size_t in_max_bytes) -> void { m_max_bytes = in_max_bytes; }
+	// Budgets of single files, such as a batch budget split between them, they take precedence over the budget of every file
+	auto set_file_budgets(std::unordered_map<std::string, size_t> in_budgets) -> void { m_file_budgets = std::move(in_budgets); }
+
+	// Writes 8-bit rows of in_channels interleaved channels, throws if the file cannot be written
+	auto write(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> void;
+
+	// Writes the indexed encoding only if it is smaller than in_size_limit bytes, returns whether the file was written.
+	// A shared palette is always written, every frame has to index the same colours.
+	// Over a byte budget that in_size_limit does not meet either, the most colours whose encoding fits are written, or the fewest when none does.
+	auto write_quantized(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, size_t in_size_limit) -> bool;
+
+	// Probes the colours and counts the verdict, returns whether quantizing the image is worth it, ptr_pixels is not read for paletted files.
+	// Files over their byte budget are always worth it.
+	auto precheck(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, size_t in_encoded_size, bool in_is_paletted) -> bool;
+
+	// Time spent quantizing, in process or in pngquant, the pre-check summary extrapolates it to the skipped pixels
+	auto record_quantize_time(size_t in_pixel_count, double in_seconds) -> void;
+
+	// One pixel per entry in a single row, the PLTE chunk holds the palette itself
+	auto write_palette(const std::string& in_file_path, const palette& in_palette) const -> void;
+
+	// Extra bytes a write of in_pixel_count pixels holds on top of them, the optimize trials in flight, the histogram sort, indices and both encodings in memory,
+	// and the search candidates under a budget
+	[[nodiscard]] auto get_working_size(size_t in_pixel_count, size_t in_channels) const -> size_t;
+
+	[[nodiscard]] auto get_encoder_name() const -> const char*;
+	[[nodiscard]] auto get_raw_bytes() const -> size_t { return m_raw_bytes; }
+	[[nodiscard]] auto get_encoded_bytes() const -> size_t { return m_encoded_bytes; }
+	[[nodiscard]] auto get_quantized_files() const -> size_t { return m_quantized_files; }
+	[[nodiscard]] auto get_truecolor_files() const -> size_t { return m_truecolor_files; }
+	[[nodiscard]] auto get_failed_files() const -> size_t { return m_failed_files; }
+	[[nodiscard]] auto get_paletted_files() const -> size_t { return m_paletted_files; }
+	[[nodiscard]] auto get_hopeless_files() const -> size_t { return m_hopeless_files; }
+	[[nodiscard]] auto get_saved_seconds() const -> double;
+	[[nodiscard]] auto get_searched_files() const -> size_t { return m_searched_files; }
+	[[nodiscard]] auto get_over_budget_files() const -> size_t { return m_over_budget_files; }
+	[[nodiscard]] auto get_search_encodes() const -> size_t { return m_search_encodes; }
+
+  private:
+	png_encoder m_encoder;
+	png_effort m_effort;
+	thread_pool* m_ptr_pool;
+	bool m_optimize{false};
+	const quantizer* m_ptr_quantizer{nullptr};
+	const palette* m_ptr_shared_palette{nullptr};
+	const pngquant_runner* m_ptr_pngquant{nullptr};
+	size_t m_max_bytes{0};
+	std::unordered_map<std::string, size_t> m_file_budgets;
+
+	std::atomic<size_t> m_raw_bytes{0};
+	std::atomic<size_t> m_encoded_bytes{0};
+	std::atomic<size_t> m_quantized_files{0};
+	std::atomic<size_t> m_truecolor_files{0};
+	std::atomic<size_t> m_failed_files{0};
+	std::atomic<size_t> m_paletted_files{0};
+	std::atomic<size_t> m_hopeless_files{0};
+	std::atomic<size_t> m_skipped_pixels{0};
+	std::atomic<size_t> m_quantized_pixels{0};
+	std::atomic<uint64_t> m_quantize_nanoseconds{0};
+	std::atomic<size_t> m_searched_files{0};
+	std::atomic<size_t> m_over_budget_files{0};
+	std::atomic<size_t> m_search_encodes{0};
+	// Sizes of the search winners and what the colour model predicted for them, their ratio seeds the next search
+	std::atomic<uint64_t> m_search_actual_bytes{0};
+	std::atomic<uint64_t> m_search_predicted_bytes{0};
+
+	// Truecolour encoding with the selected backend
+	auto encode(const byte_sink& in_sink, const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) const -> void;
+
+	// Indexed encoding of one palette index per pixel
+	[[nodiscard]] auto encode_indexed(const std::string& in_file_path, const std::vector<uint8_t>& in_indices, int32_t in_width, int32_t in_height, const palette& in_palette,
+									  png_effort in_effort) const -> std::vector<uint8_t>;
+
+	// Narrows the colour count between what fits in_budget and in_top, the over budget encoding at in_top_colors, a few candidates per round
+	[[nodiscard]] auto search_budget(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels,
+									 const std::vector<color_count>& in_histogram, size_t in_budget, std::vector<uint8_t> in_top, size_t in_top_colors) -> std::vector<uint8_t>;
+
+	// 0 when the file has no budget
+	[[nodiscard]] auto get_byte_budget(const std::string& in_file_path) const -> size_t;
+};
+
+#endif /* F3C81A5D_6E27_4B90_9D14_A8E0C57B2F36 */
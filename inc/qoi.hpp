@@ -0,0 +1,28 @@
+#ifndef A9D3F7B2_6C41_4E05_B8A2_1E7C94D06F3B
+#define A9D3F7B2_6C41_4E05_B8A2_1E7C94D06F3B
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+
+// The Quite OK Image format, one pass over the file with a 64 entry colour cache and no entropy coder, so it decodes several times faster than PNG.
+// Files are always RGB or RGBA, the colour space byte is kept but not interpreted.
+class qoi_codec
+{
+  public:
+	// Whether the file starts with the qoif magic
+	[[nodiscard]] static auto can_read(const std::string& in_file_path) -> bool;
+
+	[[nodiscard]] static auto read_header(const std::string& in_file_path) -> image_header;
+
+	// in_channels of 0 keeps the channels of the file, 1 and 2 are grey weighted the way stb converts
+	[[nodiscard]] static auto decode(const std::string& in_file_path, size_t in_channels = 0) -> pixel_buffer;
+
+	// Grey and grey+alpha are widened to RGB and RGBA, the format has nothing smaller
+	[[nodiscard]] static auto encode(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> std::vector<uint8_t>;
+};
+
+#endif /* A9D3F7B2_6C41_4E05_B8A2_1E7C94D06F3B */
@@ -0,0 +1,74 @@
+#ifndef B6E0D94A_3F1C_4A72_8C55_E19D07A3B628
+#define B6E0D94A_3F1C_4A72_8C55_E19D07A3B628
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class quantizer_backend : uint8_t
+{
+	internal,
+	pngquant
+};
+
+using rgba	  = std::array<uint8_t, 4>;
+using palette = std::vector<rgba>;
+
+// Pre-check verdict, only beneficial images are worth the quantization work
+enum class compress_class : uint8_t
+{
+	paletted,
+	beneficial,
+	skip
+};
+
+// Colour statistics of a sample of rows
+struct color_probe
+{
+	size_t unique_colors;
+	// Shannon entropy of the sampled colours in bits per pixel
+	double entropy;
+};
+
+// Unique RGBA colour packed as r | g << 8 | b << 16 | a << 24 and how many pixels use it
+struct color_count
+{
+	uint32_t color;
+	uint32_t count;
+};
+
+// Palette reduction in the spirit of pngquant: median cut over the colour histogram, a few k-means passes, then a nearest colour remap.
+// Fully transparent pixels all collapse into one palette entry.
+class quantizer
+{
+  public:
+	explicit quantizer(size_t in_max_colors = 256, bool in_dither = false);
+
+	// Sorted unique colours of 8-bit pixels with 1 to 4 channels, grey and RGB are widened to RGBA, in_step > 1 samples every in_step-th pixel
+	[[nodiscard]] static auto build_histogram(const uint8_t* ptr_pixels, size_t in_pixel_count, size_t in_channels, size_t in_step = 1) -> std::vector<color_count>;
+
+	// One histogram with the counts of every input summed, used to build a palette shared by a whole batch
+	[[nodiscard]] static auto merge_histograms(const std::vector<std::vector<color_count>>& in_histograms) -> std::vector<color_count>;
+
+	// Unique colours and entropy of every few rows, runs of equal pixels are folded before the histogram
+	[[nodiscard]] static auto probe(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> color_probe;
+
+	// Paletted files are never sent, exact palettes always are, lossy ones only when the current encoding leaves room next to the colour entropy
+	[[nodiscard]] static auto classify(const color_probe& in_probe, bool in_is_paletted, size_t in_encoded_size, size_t in_pixel_count) -> compress_class;
+
+	// At most max colours, sorted by alpha so the tRNS chunk only covers the translucent head
+	[[nodiscard]] auto build_palette(std::vector<color_count> in_histogram) const -> palette;
+
+	// Index of the nearest palette entry for every pixel, with Floyd-Steinberg error diffusion when dithering
+	[[nodiscard]] auto remap(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, const palette& in_palette) const -> std::vector<uint8_t>;
+
+	[[nodiscard]] auto get_max_colors() const -> size_t { return m_max_colors; }
+	[[nodiscard]] auto get_dither() const -> bool { return m_dither; }
+
+  private:
+	size_t m_max_colors;
+	bool m_dither;
+};
+
+#endif /* B6E0D94A_3F1C_4A72_8C55_E19D07A3B628 */
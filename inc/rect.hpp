@@ -1,6 +1,7 @@
 #ifndef B2B19C29_3CE9_4DBE_8B07_82C4B6EB5634
 #define B2B19C29_3CE9_4DBE_8B07_82C4B6EB5634
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 
@@ -27,6 +28,29 @@ class rect
 	auto set_width(int32_t in_width) -> void { m_width = in_width; }
 	auto set_height(int32_t in_height) -> void { m_height = in_height; }
 
+	// Smallest rect holding both, an empty rect does not contribute
+	[[nodiscard]] auto get_union(const rect& in_rect) const -> rect
+	{
+		if (in_rect.get_area() <= 0)
+		{
+			return *this;
+		}
+
+		if (get_area() <= 0)
+		{
+			return in_rect;
+		}
+
+		return {std::min(m_start_x, in_rect.m_start_x), std::min(m_start_y, in_rect.m_start_y), std::max(m_start_x + m_width, in_rect.m_start_x + in_rect.m_width),
+				std::max(m_start_y + m_height, in_rect.m_start_y + in_rect.m_height)};
+	}
+
+	[[nodiscard]] auto contains(const rect& in_rect) const -> bool
+	{
+		return m_start_x <= in_rect.m_start_x && m_start_y <= in_rect.m_start_y && m_start_x + m_width >= in_rect.m_start_x + in_rect.m_width
+			&& m_start_y + m_height >= in_rect.m_start_y + in_rect.m_height;
+	}
+
 	auto operator>(const rect& in_rect) const -> bool { return get_perimeter() > in_rect.get_perimeter(); }
 
   private:
@@ -0,0 +1,85 @@
+#ifndef A9D3F7E1_2C64_4B8A_8E15_C07B4D92F36A
+#define A9D3F7E1_2C64_4B8A_8E15_C07B4D92F36A
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory_budget.hpp"
+
+// One persistent set of worker threads shared by every stage of the run.
+// Each worker owns a queue, batches are dealt out largest cost first and idle workers steal from the back of the other queues.
+class thread_pool
+{
+  public:
+	struct task
+	{
+		size_t cost;
+		std::function<void()> work;
+		// Taken from the budget passed to run before the task is queued, the task gives it back itself
+		size_t admit_bytes{0};
+	};
+
+	explicit thread_pool(size_t in_num_threads);
+	~thread_pool();
+
+	thread_pool(const thread_pool&)					   = delete;
+	thread_pool(thread_pool&&)						   = delete;
+	auto operator=(const thread_pool&) -> thread_pool& = delete;
+
+	// Runs every task and blocks until all of them are done, the first exception thrown by a task is rethrown here
+	// Can be called from inside a task, the waiting thread only helps with the tasks of this call meanwhile.
+	// With ptr_budget the calling thread acquires admit_bytes of each task before queuing it, so a full budget holds back the submission
+	// instead of parking workers. Runs with a budget therefore belong on threads outside the pool.
+	auto run(std::vector<task> in_tasks, memory_budget* ptr_budget = nullptr) -> void;
+
+	[[nodiscard]] auto get_num_threads() const -> size_t { return m_threads.size(); }
+
+	// Index of the calling worker in [0, get_num_threads()), threads outside the pool get get_num_threads()
+	[[nodiscard]] auto get_worker_index() const -> size_t;
+
+  private:
+	struct batch
+	{
+		std::atomic<size_t> remaining;
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::exception_ptr error;
+	};
+
+	struct job
+	{
+		size_t cost;
+		std::function<void()> work;
+		batch* ptr_batch;
+	};
+
+	struct queue
+	{
+		std::mutex mutex;
+		std::deque<job> jobs;
+		std::atomic<size_t> queued_cost{0};
+	};
+
+	std::vector<std::unique_ptr<queue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_sleep_condition;
+	std::atomic<size_t> m_pending{0};
+	bool m_stop{false};
+
+	auto worker_loop(size_t in_index) -> void;
+	// Jobs of ptr_only alone when it is set, any job otherwise
+	auto try_pop(size_t in_index, job& out_job, const batch* ptr_only = nullptr) -> bool;
+	auto execute(job& in_job) -> void;
+};
+
+#endif /* A9D3F7E1_2C64_4B8A_8E15_C07B4D92F36A */
@@ -0,0 +1,38 @@
+#ifndef B5E8C1F4_2D97_4A36_9C0B_8F3A61E4D72C
+#define B5E8C1F4_2D97_4A36_9C0B_8F3A61E4D72C
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+
+// WebP through libwebp when its headers are found at build time, without them every call but can_read throws.
+// Files decode to RGB or RGBA, whichever the bitstream says.
+class webp_codec
+{
+  public:
+	// Whether libwebp was compiled in
+	[[nodiscard]] static auto is_available() -> bool;
+
+	// Whether the file is a RIFF container of type WEBP
+	[[nodiscard]] static auto can_read(const std::string& in_file_path) -> bool;
+
+	[[nodiscard]] static auto read_header(const std::string& in_file_path) -> image_header;
+
+	// in_channels of 0 keeps the channels of the file, otherwise 3 or 4
+	[[nodiscard]] static auto decode(const std::string& in_file_path, size_t in_channels = 0) -> pixel_buffer;
+
+	// Whether the bitstream is VP8 rather than VP8L, only the header is read
+	[[nodiscard]] static auto is_lossy(const std::string& in_file_path) -> bool;
+
+	// Quality of the lossy encodes, 1 to 100, shared by every call
+	static auto set_quality(int32_t in_quality) -> void;
+
+	// Lossless sources stay lossless, lossy ones are encoded lossy at the set quality since a lossless photo would be several times larger.
+	// Grey and grey+alpha are widened to RGB and RGBA
+	[[nodiscard]] static auto encode(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, bool in_lossy) -> std::vector<uint8_t>;
+};
+
+#endif /* B5E8C1F4_2D97_4A36_9C0B_8F3A61E4D72C */
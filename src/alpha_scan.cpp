@@ -0,0 +1,489 @@
+#include "alpha_scan.hpp"
+
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define ALPHA_SCAN_X86 1
+#endif
+
+namespace
+{
+	constexpr size_t rgba_stride = 4;
+	constexpr size_t rgba_offset = 3;
+
+	using kernel = alpha_scan::kernel;
+
+#ifdef ALPHA_SCAN_X86
+	// Every kernel returns a bit per pixel (bit i => pixel i has alpha above the threshold) for one block of pixels
+
+	auto block_sse2(const uint8_t* ptr_pixels, __m128i in_threshold) -> uint32_t
+	{
+		uint32_t mask = 0;
+
+		for (int32_t idx = 0; idx < 4; ++idx)
+		{
+			const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_pixels) + idx);
+			const __m128i alpha	 = _mm_srli_epi32(pixels, 24);
+
+			mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(alpha, in_threshold)))) << (idx * 4);
+		}
+
+		return mask;
+	}
+
+	__attribute__((target("avx2"))) auto block_avx2(const uint8_t* ptr_pixels, __m256i in_threshold) -> uint32_t
+	{
+		uint32_t mask = 0;
+
+		for (int32_t idx = 0; idx < 4; ++idx)
+		{
+			const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr_pixels) + idx);
+			const __m256i alpha	 = _mm256_srli_epi32(pixels, 24);
+
+			mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(alpha, in_threshold)))) << (idx * 8);
+		}
+
+		return mask;
+	}
+
+	__attribute__((target("avx512f"))) auto block_avx512(const uint8_t* ptr_pixels, __m512i in_threshold) -> uint64_t
+	{
+		uint64_t mask = 0;
+
+		for (int32_t idx = 0; idx < 4; ++idx)
+		{
+			const __m512i pixels = _mm512_loadu_si512(ptr_pixels + static_cast<ptrdiff_t>(idx * 64));
+			const __m512i alpha	 = _mm512_srli_epi32(pixels, 24);
+
+			mask |= static_cast<uint64_t>(_mm512_cmpgt_epu32_mask(alpha, in_threshold)) << (idx * 16);
+		}
+
+		return mask;
+	}
+
+	// Alpha plane blocks are 64 pixels for every instruction set, bytes are compared unsigned by flipping their sign bit
+
+	auto plane_block_sse2(const uint8_t* ptr_pixels, __m128i in_threshold) -> uint64_t
+	{
+		const __m128i sign = _mm_set1_epi8(static_cast<char>(0x80));
+		uint64_t mask	   = 0;
+
+		for (int32_t idx = 0; idx < 4; ++idx)
+		{
+			const __m128i alpha = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_pixels) + idx), sign);
+
+			mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(alpha, in_threshold)))) << (idx * 16);
+		}
+
+		return mask;
+	}
+
+	__attribute__((target("avx2"))) auto plane_block_avx2(const uint8_t* ptr_pixels, __m256i in_threshold) -> uint64_t
+	{
+		const __m256i sign = _mm256_set1_epi8(static_cast<char>(0x80));
+		uint64_t mask	   = 0;
+
+		for (int32_t idx = 0; idx < 2; ++idx)
+		{
+			const __m256i alpha = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr_pixels) + idx), sign);
+
+			mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(alpha, in_threshold)))) << (idx * 32);
+		}
+
+		return mask;
+	}
+
+	__attribute__((target("avx512bw"))) auto plane_block_avx512(const uint8_t* ptr_pixels, __m512i in_threshold) -> uint64_t
+	{
+		return _mm512_cmpgt_epu8_mask(_mm512_loadu_si512(ptr_pixels), in_threshold);
+	}
+#endif
+
+	auto first_plane_scalar(const uint8_t* ptr_pixels, int32_t in_begin, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		for (int32_t pos_x = in_begin; pos_x < in_count; ++pos_x)
+		{
+			if (ptr_pixels[pos_x] > in_threshold)
+			{
+				return pos_x;
+			}
+		}
+
+		return -1;
+	}
+
+	auto last_plane_scalar(const uint8_t* ptr_pixels, int32_t in_end, uint8_t in_threshold) -> int32_t
+	{
+		for (int32_t pos_x = in_end - 1; pos_x >= 0; --pos_x)
+		{
+			if (ptr_pixels[pos_x] > in_threshold)
+			{
+				return pos_x;
+			}
+		}
+
+		return -1;
+	}
+
+	auto first_rgba_scalar(const uint8_t* ptr_pixels, int32_t in_begin, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		for (int32_t pos_x = in_begin; pos_x < in_count; ++pos_x)
+		{
+			if (ptr_pixels[static_cast<size_t>(pos_x) * rgba_stride + rgba_offset] > in_threshold)
+			{
+				return pos_x;
+			}
+		}
+
+		return -1;
+	}
+
+	auto last_rgba_scalar(const uint8_t* ptr_pixels, int32_t in_end, uint8_t in_threshold) -> int32_t
+	{
+		for (int32_t pos_x = in_end - 1; pos_x >= 0; --pos_x)
+		{
+			if (ptr_pixels[static_cast<size_t>(pos_x) * rgba_stride + rgba_offset] > in_threshold)
+			{
+				return pos_x;
+			}
+		}
+
+		return -1;
+	}
+
+#ifdef ALPHA_SCAN_X86
+	// Block searches, the pixels left over after the last full block go through the scalar loop
+
+	auto find_first_sse2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m128i threshold = _mm_set1_epi32(in_threshold);
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 16 <= in_count; pos_x += 16)
+		{
+			const uint32_t mask = block_sse2(ptr_pixels + static_cast<size_t>(pos_x) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_rgba_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	auto find_last_sse2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m128i threshold = _mm_set1_epi32(in_threshold);
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 16 >= 0; pos_x -= 16)
+		{
+			const uint32_t mask = block_sse2(ptr_pixels + static_cast<size_t>(pos_x - 16) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(static_cast<uint16_t>(mask));
+			}
+		}
+
+		return last_rgba_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+
+	__attribute__((target("avx2"))) auto find_first_avx2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m256i threshold = _mm256_set1_epi32(in_threshold);
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 32 <= in_count; pos_x += 32)
+		{
+			const uint32_t mask = block_avx2(ptr_pixels + static_cast<size_t>(pos_x) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_rgba_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	__attribute__((target("avx2"))) auto find_last_avx2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m256i threshold = _mm256_set1_epi32(in_threshold);
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 32 >= 0; pos_x -= 32)
+		{
+			const uint32_t mask = block_avx2(ptr_pixels + static_cast<size_t>(pos_x - 32) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(mask);
+			}
+		}
+
+		return last_rgba_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+
+	__attribute__((target("avx512f"))) auto find_first_avx512(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m512i threshold = _mm512_set1_epi32(in_threshold);
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 64 <= in_count; pos_x += 64)
+		{
+			const uint64_t mask = block_avx512(ptr_pixels + static_cast<size_t>(pos_x) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_rgba_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	__attribute__((target("avx512f"))) auto find_last_avx512(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m512i threshold = _mm512_set1_epi32(in_threshold);
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 64 >= 0; pos_x -= 64)
+		{
+			const uint64_t mask = block_avx512(ptr_pixels + static_cast<size_t>(pos_x - 64) * rgba_stride, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(mask);
+			}
+		}
+
+		return last_rgba_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+
+	// Alpha plane searches, one byte per pixel
+
+	auto plane_first_sse2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m128i threshold = _mm_set1_epi8(static_cast<char>(in_threshold ^ 0x80));
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 64 <= in_count; pos_x += 64)
+		{
+			const uint64_t mask = plane_block_sse2(ptr_pixels + pos_x, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_plane_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	auto plane_last_sse2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m128i threshold = _mm_set1_epi8(static_cast<char>(in_threshold ^ 0x80));
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 64 >= 0; pos_x -= 64)
+		{
+			const uint64_t mask = plane_block_sse2(ptr_pixels + pos_x - 64, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(mask);
+			}
+		}
+
+		return last_plane_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+
+	__attribute__((target("avx2"))) auto plane_first_avx2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m256i threshold = _mm256_set1_epi8(static_cast<char>(in_threshold ^ 0x80));
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 64 <= in_count; pos_x += 64)
+		{
+			const uint64_t mask = plane_block_avx2(ptr_pixels + pos_x, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_plane_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	__attribute__((target("avx2"))) auto plane_last_avx2(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m256i threshold = _mm256_set1_epi8(static_cast<char>(in_threshold ^ 0x80));
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 64 >= 0; pos_x -= 64)
+		{
+			const uint64_t mask = plane_block_avx2(ptr_pixels + pos_x - 64, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(mask);
+			}
+		}
+
+		return last_plane_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+
+	__attribute__((target("avx512bw"))) auto plane_first_avx512(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m512i threshold = _mm512_set1_epi8(static_cast<char>(in_threshold));
+		int32_t pos_x			= 0;
+
+		for (; pos_x + 64 <= in_count; pos_x += 64)
+		{
+			const uint64_t mask = plane_block_avx512(ptr_pixels + pos_x, threshold);
+			if (mask != 0)
+			{
+				return pos_x + std::countr_zero(mask);
+			}
+		}
+
+		return first_plane_scalar(ptr_pixels, pos_x, in_count, in_threshold);
+	}
+
+	__attribute__((target("avx512bw"))) auto plane_last_avx512(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t
+	{
+		const __m512i threshold = _mm512_set1_epi8(static_cast<char>(in_threshold));
+		int32_t pos_x			= in_count;
+
+		for (; pos_x - 64 >= 0; pos_x -= 64)
+		{
+			const uint64_t mask = plane_block_avx512(ptr_pixels + pos_x - 64, threshold);
+			if (mask != 0)
+			{
+				return pos_x - 1 - std::countl_zero(mask);
+			}
+		}
+
+		return last_plane_scalar(ptr_pixels, pos_x, in_threshold);
+	}
+#endif
+
+	auto find_first_scalar(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t { return first_rgba_scalar(ptr_pixels, 0, in_count, in_threshold); }
+
+	auto find_last_scalar(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t { return last_rgba_scalar(ptr_pixels, in_count, in_threshold); }
+
+	auto plane_first_scalar(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t { return first_plane_scalar(ptr_pixels, 0, in_count, in_threshold); }
+
+	auto plane_last_scalar(const uint8_t* ptr_pixels, int32_t in_count, uint8_t in_threshold) -> int32_t { return last_plane_scalar(ptr_pixels, in_count, in_threshold); }
+
+	auto select_kernel() -> kernel
+	{
+#ifdef ALPHA_SCAN_X86
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		{
+			return {find_first_avx512, find_last_avx512, plane_first_avx512, plane_last_avx512, "avx512"};
+		}
+
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return {find_first_avx2, find_last_avx2, plane_first_avx2, plane_last_avx2, "avx2"};
+		}
+
+		return {find_first_sse2, find_last_sse2, plane_first_sse2, plane_last_sse2, "sse2"};
+#else
+		return alpha_scan::get_scalar_kernel();
+#endif
+	}
+
+	auto get_kernel() -> const kernel&
+	{
+		static const kernel s_kernel = select_kernel();
+		return s_kernel;
+	}
+} // namespace
+
+alpha_scan::alpha_scan(size_t in_stride, size_t in_offset, uint8_t in_threshold)
+	: m_stride(in_stride), m_offset(in_offset), m_threshold(in_threshold), m_find_first(nullptr), m_find_last(nullptr)
+{
+	if (m_stride == rgba_stride && m_offset == rgba_offset)
+	{
+		m_find_first = get_kernel().first;
+		m_find_last	 = get_kernel().last;
+	}
+	else if (m_stride == 1 && m_offset == 0)
+	{
+		m_find_first = get_kernel().plane_first;
+		m_find_last	 = get_kernel().plane_last;
+	}
+}
+
+auto alpha_scan::find_first(const uint8_t* ptr_row, int32_t in_begin, int32_t in_end) const -> int32_t
+{
+	if (in_begin >= in_end)
+	{
+		return -1;
+	}
+
+	if (m_find_first != nullptr)
+	{
+		const auto pos_x = m_find_first(ptr_row + static_cast<size_t>(in_begin) * m_stride, in_end - in_begin, m_threshold);
+		return pos_x < 0 ? -1 : in_begin + pos_x;
+	}
+
+	for (int32_t pos_x = in_begin; pos_x < in_end; ++pos_x)
+	{
+		if (is_opaque(ptr_row, pos_x))
+		{
+			return pos_x;
+		}
+	}
+
+	return -1;
+}
+
+auto alpha_scan::find_last(const uint8_t* ptr_row, int32_t in_begin, int32_t in_end) const -> int32_t
+{
+	if (in_begin >= in_end)
+	{
+		return -1;
+	}
+
+	if (m_find_last != nullptr)
+	{
+		const auto pos_x = m_find_last(ptr_row + static_cast<size_t>(in_begin) * m_stride, in_end - in_begin, m_threshold);
+		return pos_x < 0 ? -1 : in_begin + pos_x;
+	}
+
+	for (int32_t pos_x = in_end - 1; pos_x >= in_begin; --pos_x)
+	{
+		if (is_opaque(ptr_row, pos_x))
+		{
+			return pos_x;
+		}
+	}
+
+	return -1;
+}
+
+auto alpha_scan::get_isa_name() -> const char* { return get_kernel().name; }
+
+auto alpha_scan::get_supported_kernels() -> std::vector<kernel>
+{
+	std::vector<kernel> kernels;
+#ifdef ALPHA_SCAN_X86
+	__builtin_cpu_init();
+
+	kernels.push_back({find_first_sse2, find_last_sse2, plane_first_sse2, plane_last_sse2, "sse2"});
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernels.push_back({find_first_avx2, find_last_avx2, plane_first_avx2, plane_last_avx2, "avx2"});
+	}
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+	{
+		kernels.push_back({find_first_avx512, find_last_avx512, plane_first_avx512, plane_last_avx512, "avx512"});
+	}
+#else
+	kernels.push_back(get_scalar_kernel());
+#endif
+	return kernels;
+}
+
+auto alpha_scan::get_scalar_kernel() -> kernel { return {find_first_scalar, find_last_scalar, plane_first_scalar, plane_last_scalar, "scalar"}; }
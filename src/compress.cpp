@@ -0,0 +1,330 @@
+#include "compress.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "file_sink.hpp"
+#include "jpeg.hpp"
+
+extern char** environ;
+
+namespace
+{
+	// pngquant leaves the file alone and exits with these when the result would be larger or below the quality floor
+	constexpr int32_t exit_skipped = 98;
+	constexpr int32_t exit_quality = 99;
+
+	constexpr size_t read_chunk = size_t{64} * 1024;
+
+	struct process_output
+	{
+		// -1 when the process could not be started or was killed by a signal
+		int32_t exit_code;
+		bool started;
+		std::vector<uint8_t> out;
+		std::string err;
+	};
+
+	// Closes the descriptor on every exit path
+	struct file_descriptor
+	{
+		int32_t fd{-1};
+
+		file_descriptor() = default;
+		~file_descriptor() { reset(); }
+
+		file_descriptor(const file_descriptor&)					   = delete;
+		file_descriptor(file_descriptor&&)						   = delete;
+		auto operator=(const file_descriptor&) -> file_descriptor& = delete;
+
+		auto reset() -> void
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+				fd = -1;
+			}
+		}
+	};
+
+	auto make_pipe(file_descriptor& out_read, file_descriptor& out_write) -> void
+	{
+		std::array<int32_t, 2> fds{};
+		if (pipe2(fds.data(), O_CLOEXEC) != 0)
+		{
+			throw std::runtime_error(std::string("Failed to create pipe: ") + std::strerror(errno));
+		}
+
+		out_read.fd	 = fds[0];
+		out_write.fd = fds[1];
+	}
+
+	// Appends what is available, returns false once the other end is closed
+	auto drain(file_descriptor& in_fd, std::vector<uint8_t>& out_data) -> bool
+	{
+		std::array<uint8_t, read_chunk> buffer{};
+
+		const auto count = read(in_fd.fd, buffer.data(), buffer.size());
+		if (count > 0)
+		{
+			out_data.insert(out_data.end(), buffer.data(), buffer.data() + count);
+			return true;
+		}
+
+		if (count < 0 && (errno == EINTR || errno == EAGAIN))
+		{
+			return true;
+		}
+
+		in_fd.reset();
+		return false;
+	}
+
+	// Spawns in_args[0] from PATH, feeds ptr_input to its stdin and collects stdout and stderr.
+	// All three pipes are serviced from one poll loop, so the child can never stall on a full pipe while we wait on another.
+	auto run_process(const std::vector<std::string>& in_args, const std::vector<uint8_t>* ptr_input) -> process_output
+	{
+		file_descriptor in_read;
+		file_descriptor in_write;
+		file_descriptor out_read;
+		file_descriptor out_write;
+		file_descriptor err_read;
+		file_descriptor err_write;
+
+		make_pipe(out_read, out_write);
+		make_pipe(err_read, err_write);
+		if (ptr_input != nullptr)
+		{
+			make_pipe(in_read, in_write);
+		}
+
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+
+		if (ptr_input != nullptr)
+		{
+			posix_spawn_file_actions_adddup2(&actions, in_read.fd, STDIN_FILENO);
+		}
+		else
+		{
+			posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+		}
+
+		posix_spawn_file_actions_adddup2(&actions, out_write.fd, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, err_write.fd, STDERR_FILENO);
+
+		std::vector<char*> argv;
+		for (const auto& arg : in_args)
+		{
+			argv.push_back(const_cast<char*>(arg.c_str()));
+		}
+		argv.push_back(nullptr);
+
+		pid_t pid		  = 0;
+		const auto status = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+		posix_spawn_file_actions_destroy(&actions);
+
+		if (status != 0)
+		{
+			return {-1, false, {}, std::format("Failed to start {}: {}", in_args[0], std::strerror(status))};
+		}
+
+		// Only the child keeps these ends, otherwise the reads below never see the end of the stream
+		in_read.reset();
+		out_write.reset();
+		err_write.reset();
+
+		process_output output{-1, true, {}, {}};
+		std::vector<uint8_t> err;
+
+		size_t written = 0;
+		if (in_write.fd >= 0)
+		{
+			fcntl(in_write.fd, F_SETFL, fcntl(in_write.fd, F_GETFL) | O_NONBLOCK);
+		}
+
+		while (out_read.fd >= 0 || err_read.fd >= 0)
+		{
+			std::array<pollfd, 3> fds{{{out_read.fd, POLLIN, 0}, {err_read.fd, POLLIN, 0}, {in_write.fd, POLLOUT, 0}}};
+
+			if (poll(fds.data(), fds.size(), -1) < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				break;
+			}
+
+			if (fds[0].revents != 0)
+			{
+				drain(out_read, output.out);
+			}
+
+			if (fds[1].revents != 0)
+			{
+				drain(err_read, err);
+			}
+
+			if (fds[2].revents != 0)
+			{
+				const auto count = write(in_write.fd, ptr_input->data() + written, ptr_input->size() - written);
+				if (count > 0)
+				{
+					written += static_cast<size_t>(count);
+				}
+
+				// A child that exits without reading all of stdin is not an error here, its exit code tells
+				if ((count < 0 && errno != EINTR && errno != EAGAIN) || written == ptr_input->size())
+				{
+					in_write.reset();
+				}
+			}
+		}
+
+		in_write.reset();
+
+		int32_t wait_status = 0;
+		while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR)
+		{
+		}
+
+		output.exit_code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1;
+		output.err.assign(err.begin(), err.end());
+
+		while (!output.err.empty() && std::isspace(static_cast<unsigned char>(output.err.back())) != 0)
+		{
+			output.err.pop_back();
+		}
+
+		return output;
+	}
+
+	auto get_message(const process_output& in_output) -> std::string { return in_output.err.empty() ? std::format("pngquant exited with {}", in_output.exit_code) : in_output.err; }
+
+	auto is_skip(int32_t in_exit_code) -> bool { return in_exit_code == exit_skipped || in_exit_code == exit_quality; }
+
+	// Size and modification time, pngquant rewrites the file in place so a change in either means it wrote it
+	auto get_stamp(const std::string& in_file_path) -> std::pair<uintmax_t, std::filesystem::file_time_type>
+	{
+		std::error_code error;
+
+		const auto size = std::filesystem::file_size(in_file_path, error);
+		const auto time = std::filesystem::last_write_time(in_file_path, error);
+
+		return {size, time};
+	}
+} // namespace
+
+pngquant_runner::pngquant_runner(size_t in_batch_size) : m_batch_size(std::max<size_t>(in_batch_size, 1)) {}
+
+auto pngquant_runner::compress_files(const std::vector<std::string>& in_file_paths) const -> std::vector<compress_result>
+{
+	std::vector<compress_result> results;
+	if (in_file_paths.empty())
+	{
+		return results;
+	}
+
+	std::vector<std::pair<uintmax_t, std::filesystem::file_time_type>> stamps;
+	std::vector<std::string> args{"pngquant", "--ext", ".png", "--force", "--strip", "--skip-if-larger", "--"};
+
+	for (const auto& file_path : in_file_paths)
+	{
+		stamps.push_back(get_stamp(file_path));
+		args.push_back(file_path);
+	}
+
+	const auto output = run_process(args, nullptr);
+
+	// The exit code of a batch only describes the last failure, so the files it left alone are retried one at a time to find the real culprits
+	const bool batch_failed = output.exit_code != 0 && !is_skip(output.exit_code);
+	const bool retry		= batch_failed && output.started && in_file_paths.size() > 1;
+	if (retry)
+	{
+		spdlog::warn("pngquant failed on a batch of {} files, retrying the untouched ones one by one: {}", in_file_paths.size(), get_message(output));
+	}
+
+	for (size_t idx = 0; idx < in_file_paths.size(); ++idx)
+	{
+		if (get_stamp(in_file_paths[idx]) != stamps[idx])
+		{
+			results.push_back({in_file_paths[idx], compress_status::compressed, {}});
+		}
+		else if (!batch_failed)
+		{
+			results.push_back({in_file_paths[idx], compress_status::skipped, {}});
+		}
+		else if (retry)
+		{
+			results.push_back(std::move(compress_files({in_file_paths[idx]}).front()));
+		}
+		else
+		{
+			results.push_back({in_file_paths[idx], compress_status::failed, get_message(output)});
+		}
+	}
+
+	return results;
+}
+
+auto pngquant_runner::compress_buffer(const std::vector<uint8_t>& in_png, std::vector<uint8_t>& out_png, std::string& out_message) const -> compress_status
+{
+	// A lone dash makes pngquant read stdin and write stdout
+	auto output = run_process({"pngquant", "--strip", "--skip-if-larger", "-"}, &in_png);
+
+	if (output.exit_code == 0 && !output.out.empty())
+	{
+		out_png = std::move(output.out);
+		return compress_status::compressed;
+	}
+
+	if (is_skip(output.exit_code))
+	{
+		return compress_status::skipped;
+	}
+
+	out_message = get_message(output);
+	return compress_status::failed;
+}
+
+auto compress_png(const std::string_view& file_path) -> void
+{
+	const pngquant_runner runner;
+
+	const auto result = runner.compress_files({std::string(file_path)}).front();
+	if (result.status == compress_status::failed)
+	{
+		throw std::runtime_error("Failed to compress PNG file: " + result.message);
+	}
+}
+
+auto compress_jpeg(const std::string_view& file_path) -> void
+{
+	const std::string path(file_path);
+	const auto optimized = jpeg_codec::optimize(path);
+
+	// Same rule as pngquant --skip-if-larger, the progressive scans do not always win on tiny files
+	if (optimized.size() >= std::filesystem::file_size(path))
+	{
+		return;
+	}
+
+	save_file(path, optimized);
+}
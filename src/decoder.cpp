@@ -0,0 +1,280 @@
+#include "decoder.hpp"
+
+#include "jpeg.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
+#include "webp.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.hpp"
+
+namespace
+{
+	constexpr std::array<uint8_t, 8> png_signature	= {137, 80, 78, 71, 13, 10, 26, 10};
+	constexpr std::array<uint8_t, 3> jpeg_signature = {0xFF, 0xD8, 0xFF};
+
+	struct decoder_totals
+	{
+		std::atomic<size_t> files{0};
+		std::atomic<size_t> bytes{0};
+		std::atomic<uint64_t> nanoseconds{0};
+	};
+
+	auto get_totals(image_decoder in_decoder) -> decoder_totals&
+	{
+		static std::array<decoder_totals, image_decoder_count> totals;
+		return totals[static_cast<size_t>(in_decoder)];
+	}
+
+	// Fastest first, the first one compiled in is the default for the format
+	auto get_default_order(image_format in_format) -> std::vector<image_decoder>
+	{
+		switch (in_format)
+		{
+		case image_format::png:
+			return {image_decoder::png_rows, image_decoder::stb};
+		case image_format::jpeg:
+			return {image_decoder::libjpeg, image_decoder::stb};
+		case image_format::qoi:
+			return {image_decoder::qoi};
+		case image_format::webp:
+			return {image_decoder::webp};
+		default:
+			return {image_decoder::stb};
+		}
+	}
+
+	auto check_channels(size_t in_decoded, size_t in_requested, const std::string& in_file_path) -> void
+	{
+		if (in_requested != 0 && in_requested != in_decoded)
+		{
+			throw std::runtime_error("Decoder cannot convert to " + std::to_string(in_requested) + " channels: " + in_file_path);
+		}
+	}
+
+	auto decode_stb(const std::string& in_file_path, size_t in_channels) -> pixel_buffer
+	{
+		int32_t width;
+		int32_t height;
+		int32_t channels;
+		uint8_t* ptr_data = stbi_load(in_file_path.c_str(), &width, &height, &channels, static_cast<int32_t>(in_channels));
+
+		if (ptr_data == nullptr)
+		{
+			throw std::runtime_error("Failed to load image: " + in_file_path);
+		}
+
+		pixel_buffer result{width, height, in_channels == 0 ? static_cast<size_t>(channels) : in_channels, {}, {}};
+		result.pixels.assign(ptr_data, ptr_data + static_cast<size_t>(width) * static_cast<size_t>(height) * result.channels);
+		stbi_image_free(ptr_data);
+
+		return result;
+	}
+
+	auto decode_png_rows(const std::string& in_file_path, size_t in_channels) -> pixel_buffer
+	{
+		auto result = png_reader::decode(in_file_path);
+		check_channels(result.channels, in_channels, in_file_path);
+
+		return result;
+	}
+} // namespace
+
+auto decoder_registry::sniff(const std::string& in_file_path) -> image_format
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+
+	std::array<uint8_t, 12> header{};
+	file.read(reinterpret_cast<char*>(header.data()), header.size());
+	const auto size = static_cast<size_t>(file.gcount());
+
+	if (size >= png_signature.size() && std::equal(png_signature.begin(), png_signature.end(), header.begin()))
+	{
+		return image_format::png;
+	}
+
+	if (size >= jpeg_signature.size() && std::equal(jpeg_signature.begin(), jpeg_signature.end(), header.begin()))
+	{
+		return image_format::jpeg;
+	}
+
+	if (size >= 4 && std::memcmp(header.data(), "qoif", 4) == 0)
+	{
+		return image_format::qoi;
+	}
+
+	if (size >= 12 && std::memcmp(header.data(), "RIFF", 4) == 0 && std::memcmp(header.data() + 8, "WEBP", 4) == 0)
+	{
+		return image_format::webp;
+	}
+
+	return image_format::unknown;
+}
+
+auto decoder_registry::supports(image_decoder in_decoder, image_format in_format) -> bool
+{
+	switch (in_decoder)
+	{
+	case image_decoder::stb:
+		return in_format == image_format::png || in_format == image_format::jpeg;
+	case image_decoder::png_rows:
+		return in_format == image_format::png;
+	case image_decoder::libjpeg:
+		return in_format == image_format::jpeg;
+	case image_decoder::qoi:
+		return in_format == image_format::qoi;
+	case image_decoder::webp:
+		return in_format == image_format::webp && webp_codec::is_available();
+	default:
+		return false;
+	}
+}
+
+auto decoder_registry::can_decode(image_format in_format) -> bool
+{
+	const auto order = get_default_order(in_format);
+	return std::any_of(order.begin(), order.end(), [in_format](image_decoder in_decoder) { return supports(in_decoder, in_format); });
+}
+
+auto decoder_registry::read_header(const std::string& in_file_path, image_format in_format) -> image_header
+{
+	switch (in_format)
+	{
+	case image_format::qoi:
+		return qoi_codec::read_header(in_file_path);
+	case image_format::webp:
+		return webp_codec::read_header(in_file_path);
+	default:
+		break;
+	}
+
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+
+	if (stbi_info(in_file_path.c_str(), &width, &height, &channels) == 0)
+	{
+		throw std::runtime_error("Failed to read image header: " + in_file_path);
+	}
+
+	return {width, height, static_cast<size_t>(channels)};
+}
+
+auto decoder_registry::decode(const std::string& in_file_path, image_decoder in_decoder, size_t in_channels) -> pixel_buffer
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	pixel_buffer result{};
+	switch (in_decoder)
+	{
+	case image_decoder::png_rows:
+		result = decode_png_rows(in_file_path, in_channels);
+		break;
+	case image_decoder::libjpeg:
+		result = jpeg_codec::decode(in_file_path);
+		check_channels(result.channels, in_channels, in_file_path);
+		break;
+	case image_decoder::qoi:
+		result = qoi_codec::decode(in_file_path, in_channels);
+		break;
+	case image_decoder::webp:
+		result = webp_codec::decode(in_file_path, in_channels);
+		break;
+	default:
+		result = decode_stb(in_file_path, in_channels);
+		break;
+	}
+
+	record_decode(in_decoder, result.pixels.size(), start);
+
+	return result;
+}
+
+auto decoder_registry::record_decode(image_decoder in_decoder, size_t in_bytes, std::chrono::steady_clock::time_point in_start) -> void
+{
+	auto& totals = get_totals(in_decoder);
+
+	++totals.files;
+	totals.bytes += in_bytes;
+	totals.nanoseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - in_start).count());
+}
+
+auto decoder_registry::get_decode_stats(image_decoder in_decoder) -> decode_stats
+{
+	const auto& totals = get_totals(in_decoder);
+	return {totals.files, totals.bytes, static_cast<double>(totals.nanoseconds) / 1e9};
+}
+
+auto decoder_registry::get_decoder_name(image_decoder in_decoder) -> const char*
+{
+	switch (in_decoder)
+	{
+	case image_decoder::png_rows:
+		return std::strcmp(png_reader::get_inflater_name(), "libdeflate") == 0 ? "png (libdeflate)" : "png (zlib)";
+	case image_decoder::libjpeg:
+		return "libjpeg-turbo";
+	case image_decoder::qoi:
+		return "qoi";
+	case image_decoder::webp:
+		return "libwebp";
+	default:
+		return "stb";
+	}
+}
+
+auto decoder_registry::get_format_name(image_format in_format) -> const char*
+{
+	switch (in_format)
+	{
+	case image_format::png:
+		return "PNG";
+	case image_format::jpeg:
+		return "JPEG";
+	case image_format::qoi:
+		return "QOI";
+	case image_format::webp:
+		return "WebP";
+	default:
+		return "unknown";
+	}
+}
+
+auto decoder_registry::prefer(image_decoder in_decoder) -> void
+{
+	if (in_decoder == image_decoder::webp && !webp_codec::is_available())
+	{
+		spdlog::warn("Built without libwebp, ignoring the {} decoder", get_decoder_name(in_decoder));
+		return;
+	}
+
+	m_preferred.push_back(in_decoder);
+}
+
+auto decoder_registry::select(image_format in_format) const -> image_decoder
+{
+	for (const auto decoder : m_preferred)
+	{
+		if (supports(decoder, in_format))
+		{
+			return decoder;
+		}
+	}
+
+	for (const auto decoder : get_default_order(in_format))
+	{
+		if (supports(decoder, in_format))
+		{
+			return decoder;
+		}
+	}
+
+	return image_decoder::stb;
+}
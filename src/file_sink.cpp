@@ -0,0 +1,70 @@
+#include "file_sink.hpp"
+
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+file_sink::file_sink(std::string in_file_path) : m_file_path(std::move(in_file_path)), m_temp_path(m_file_path + ".trimmer.tmp") {}
+
+file_sink::~file_sink()
+{
+	if (!m_is_committed)
+	{
+		m_file.close();
+
+		std::error_code error;
+		std::filesystem::remove(m_temp_path, error);
+	}
+}
+
+auto file_sink::append(const uint8_t* ptr_data, size_t in_size) -> void
+{
+	if (!m_file.is_open())
+	{
+		m_file.open(m_temp_path, std::ios::binary | std::ios::trunc);
+	}
+
+	m_file.write(reinterpret_cast<const char*>(ptr_data), static_cast<std::streamsize>(in_size));
+	m_written += in_size;
+}
+
+auto file_sink::close() -> size_t
+{
+	if (!m_file.is_open())
+	{
+		m_file.open(m_temp_path, std::ios::binary | std::ios::trunc);
+	}
+
+	m_file.close();
+	if (!m_file)
+	{
+		throw std::runtime_error("Failed to write image: " + m_file_path);
+	}
+
+	// The replacement keeps the permissions of the file it replaces
+	std::error_code error;
+	const auto status = std::filesystem::status(m_file_path, error);
+	if (!error && std::filesystem::exists(status))
+	{
+		std::filesystem::permissions(m_temp_path, status.permissions(), error);
+	}
+
+	std::filesystem::rename(m_temp_path, m_file_path, error);
+	if (error)
+	{
+		throw std::runtime_error("Failed to replace image: " + m_file_path + ": " + error.message());
+	}
+
+	m_is_committed = true;
+
+	return m_written;
+}
+
+auto save_file(const std::string& in_file_path, const std::vector<uint8_t>& in_data) -> size_t
+{
+	file_sink file(in_file_path);
+	file.append(in_data.data(), in_data.size());
+
+	return file.close();
+}
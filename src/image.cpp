@@ -1,216 +1,760 @@
 #include "image.hpp"
 
 #include "compress.hpp"
-
+#include "file_sink.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
+#include "webp.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
-#include <queue>
+#include <utility>
 
-#define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image.hpp"
 #include "stb_image_write.hpp"
 
 auto image::flood_fill() -> rect
 {
-	if (m_trim_rect.get_area() > 0)
+	if (!has_alpha())
 	{
-		return m_trim_rect;
+		return m_rect;
 	}
 
-	// Define boundary limits
-	int32_t x_min = std::numeric_limits<int32_t>::max();
-	int32_t x_max = std::numeric_limits<int32_t>::min();
-	int32_t y_min = std::numeric_limits<int32_t>::max();
-	int32_t y_max = std::numeric_limits<int32_t>::min();
+	const auto scanner = get_alpha_scan();
+	const auto width   = m_rect.get_width();
+	const auto height  = m_rect.get_height();
+
+	// The seed is the first opaque pixel in raster order
+	int32_t seed_x = -1;
+	int32_t seed_y = 0;
 
-	struct point
+	for (; seed_y < height; ++seed_y)
 	{
-		int32_t x;
+		seed_x = is_clear_row(seed_y) ? -1 : scanner.find_first(get_row(seed_y), 0, width);
+		if (seed_x >= 0)
+		{
+			break;
+		}
+	}
+
+	if (seed_x < 0)
+	{
+		return {0, 0, 0, 0};
+	}
+
+	// Horizontal run of opaque pixels, both ends inclusive
+	struct span
+	{
+		int32_t x_left;
+		int32_t x_right;
 		int32_t y;
 	};
 
-	std::vector<std::vector<bool>> visited(m_rect.get_height(), std::vector<bool>(m_rect.get_width(), false));
-	const std::array<point, 4> directions = {point{-1, 0}, point{1, 0}, point{0, -1}, point{0, 1}};
+	// One bit per pixel, every row starts on a new word
+	const auto words_per_row = (static_cast<size_t>(width) + 63) / 64;
+	std::vector<uint64_t> visited(words_per_row * static_cast<size_t>(height), 0);
+
+	std::vector<span> spans;
+	spans.reserve(static_cast<size_t>(height) * 2);
 
-	bool found_seed = false;
-	point seed;
+	auto is_visited = [&visited, words_per_row](int32_t in_x, int32_t in_y) -> bool
+	{ return ((visited[static_cast<size_t>(in_y) * words_per_row + static_cast<size_t>(in_x) / 64] >> (static_cast<size_t>(in_x) % 64)) & 1) != 0; };
 
-	for (int32_t pos_y = 0; pos_y < m_rect.get_height() && !found_seed; ++pos_y)
+	// Grows the run around in_x to its full width, marks it and queues it, returns its right end
+	auto push_span = [&](const uint8_t* ptr_row, int32_t in_x, int32_t in_y) -> int32_t
 	{
-		for (int32_t pos_x = 0; pos_x < m_rect.get_width() && !found_seed; ++pos_x)
+		int32_t x_left	= in_x;
+		int32_t x_right = in_x;
+
+		while (x_left > 0 && scanner.is_opaque(ptr_row, x_left - 1))
 		{
-			const auto alpha = m_data[(pos_y * m_rect.get_width() + pos_x) * m_channels + 3];
-			if (alpha > 0)
-			{
-				seed	   = {pos_x, pos_y};
-				found_seed = true;
-			}
+			--x_left;
 		}
-	}
 
-	if (!found_seed)
-	{
-		return {0, 0, 0, 0};
-	}
+		while (x_right + 1 < width && scanner.is_opaque(ptr_row, x_right + 1))
+		{
+			++x_right;
+		}
+
+		uint64_t* ptr_words = visited.data() + static_cast<size_t>(in_y) * words_per_row;
+
+		for (auto pos_x = static_cast<size_t>(x_left); pos_x <= static_cast<size_t>(x_right);)
+		{
+			const size_t bit   = pos_x % 64;
+			const size_t count = std::min<size_t>(64 - bit, static_cast<size_t>(x_right) + 1 - pos_x);
+
+			ptr_words[pos_x / 64] |= (count == 64 ? ~uint64_t{0} : ((uint64_t{1} << count) - 1)) << bit;
+			pos_x += count;
+		}
+
+		spans.push_back({x_left, x_right, in_y});
+
+		return x_right;
+	};
+
+	int32_t x_min = std::numeric_limits<int32_t>::max();
+	int32_t x_max = std::numeric_limits<int32_t>::min();
+	int32_t y_min = std::numeric_limits<int32_t>::max();
+	int32_t y_max = std::numeric_limits<int32_t>::min();
 
-	std::queue<point> queue;
-	queue.push(seed);
-	visited[seed.y][seed.x] = true;
+	push_span(get_row(seed_y), seed_x, seed_y);
 
-	while (!queue.empty())
+	while (!spans.empty())
 	{
-		point current = queue.front();
-		queue.pop();
+		const span current = spans.back();
+		spans.pop_back();
 
-		x_min = std::min(x_min, current.x);
-		x_max = std::max(x_max, current.x);
+		x_min = std::min(x_min, current.x_left);
+		x_max = std::max(x_max, current.x_right);
 		y_min = std::min(y_min, current.y);
 		y_max = std::max(y_max, current.y);
 
-		for (const auto& dir : directions)
+		// Every unvisited run touching the span from above or below belongs to the same component
+		for (const int32_t new_y : {current.y - 1, current.y + 1})
 		{
-			int32_t new_x = current.x + dir.x;
-			int32_t new_y = current.y + dir.y;
-
-			if (new_x >= 0 && new_x < m_rect.get_width() && new_y >= 0 && new_y < m_rect.get_height() && !visited[new_y][new_x])
+			if (new_y < 0 || new_y >= height || is_clear_row(new_y))
 			{
+				continue;
+			}
 
-				const auto alpha = m_data[(new_y * m_rect.get_width() + new_x) * m_channels + 3];
+			const uint8_t* ptr_row = get_row(new_y);
+
+			for (int32_t pos_x = current.x_left; pos_x <= current.x_right; ++pos_x)
+			{
+				pos_x = scanner.find_first(ptr_row, pos_x, current.x_right + 1);
+				if (pos_x < 0)
+				{
+					break;
+				}
 
-				if (alpha > 0)
+				if (!is_visited(pos_x, new_y))
 				{
-					queue.push({new_x, new_y});
-					visited[new_y][new_x] = true;
+					pos_x = push_span(ptr_row, pos_x, new_y);
 				}
 			}
 		}
 	}
 
-	m_trim_rect.set_x(x_min);
-	m_trim_rect.set_y(y_min);
-	m_trim_rect.set_width(x_max - x_min + 1);
-	m_trim_rect.set_height(y_max - y_min + 1);
-
-	return m_trim_rect;
+	return {x_min, y_min, x_max + 1, y_max + 1};
 }
 
-auto image::std_algo() -> rect
+auto image::std_algo() -> rect { return grow_boundings(rect{}); }
+
+auto image::grow_boundings(const rect& in_union, int32_t in_y_begin, int32_t in_y_end) -> rect
 {
-	if (m_trim_rect.get_area() > 0)
+	if (!has_alpha())
 	{
-		return m_trim_rect;
+		return in_union.get_union(m_rect);
 	}
 
+	const auto scanner = get_alpha_scan();
+	const auto width   = m_rect.get_width();
+
 	int32_t x_min = std::numeric_limits<int32_t>::max();
 	int32_t x_max = std::numeric_limits<int32_t>::min();
 	int32_t y_min = std::numeric_limits<int32_t>::max();
 	int32_t y_max = std::numeric_limits<int32_t>::min();
 
+	if (in_union.get_area() > 0)
+	{
+		x_min = in_union.get_x();
+		x_max = in_union.get_x() + in_union.get_width() - 1;
+		y_min = in_union.get_y();
+		y_max = in_union.get_y() + in_union.get_height() - 1;
+	}
+
+	const auto y_end = in_y_end < 0 ? m_rect.get_height() : std::min(in_y_end, m_rect.get_height());
+
+	for (int32_t pos_y = std::max(in_y_begin, 0); pos_y < y_end; ++pos_y)
+	{
+		if (is_clear_row(pos_y))
+		{
+			continue;
+		}
+
+		const uint8_t* ptr_row = get_row(pos_y);
+
+		if (pos_y >= y_min && pos_y <= y_max)
+		{
+			// Row already covered vertically, only the margins outside [x_min, x_max] can widen the box
+			const auto first = scanner.find_first(ptr_row, 0, std::min(x_min, width));
+			const auto last	 = scanner.find_last(ptr_row, std::max(x_max + 1, 0), width);
+
+			x_min = first >= 0 ? first : x_min;
+			x_max = last >= 0 ? last : x_max;
+			continue;
+		}
+
+		const auto first = scanner.find_first(ptr_row, 0, width);
+		if (first < 0)
+		{
+			continue;
+		}
+
+		// Only the pixels right of the current x_max can still widen the box
+		const auto last = scanner.find_last(ptr_row, std::max(first, x_max + 1), width);
+
+		x_min = std::min(x_min, first);
+		x_max = std::max(x_max, last);
+		y_min = std::min(y_min, pos_y);
+		y_max = std::max(y_max, pos_y);
+	}
+
+	if (y_max < y_min)
+	{
+		return {0, 0, 0, 0};
+	}
+
+	return {x_min, y_min, x_max + 1, y_max + 1};
+}
+
+auto image::edge_inward() -> rect
+{
+	if (!has_alpha())
+	{
+		return m_rect;
+	}
+
+	const auto scanner = get_alpha_scan();
+	const auto width   = m_rect.get_width();
+	const auto height  = m_rect.get_height();
+
+	// Walk down from the top edge until the first row holding an opaque pixel, rows flagged clear by the decoder are passed without a look
+	int32_t y_min = 0;
+	int32_t x_min = -1;
+
+	for (; y_min < height; ++y_min)
+	{
+		x_min = is_clear_row(y_min) ? -1 : scanner.find_first(get_row(y_min), 0, width);
+		if (x_min >= 0)
+		{
+			break;
+		}
+	}
+
+	if (y_min == height)
+	{
+		return {0, 0, 0, 0};
+	}
+
+	int32_t x_max = scanner.find_last(get_row(y_min), x_min, width);
+
+	// Walk up from the bottom edge, the top row is known to be opaque so this stops at y_min at the latest
+	int32_t y_max = height - 1;
+
+	while (y_max > y_min && (is_clear_row(y_max) || scanner.find_first(get_row(y_max), 0, width) < 0))
+	{
+		--y_max;
+	}
+
+	// Inside the row band only the side margins left of x_min and right of x_max can widen the box
+	for (int32_t pos_y = y_min + 1; pos_y <= y_max && (x_min > 0 || x_max < width - 1); ++pos_y)
+	{
+		if (is_clear_row(pos_y))
+		{
+			continue;
+		}
+
+		const uint8_t* ptr_row = get_row(pos_y);
+
+		const auto first = scanner.find_first(ptr_row, 0, x_min);
+		const auto last	 = scanner.find_last(ptr_row, x_max + 1, width);
+
+		x_min = first >= 0 ? first : x_min;
+		x_max = last >= 0 ? last : x_max;
+	}
+
+	return {x_min, y_min, x_max + 1, y_max + 1};
+}
+
+auto image::island_algo(size_t in_min_island) -> rect
+{
+	rect boundings;
+	size_t dropped = 0;
+
+	for (const auto& island : label_components())
+	{
+		if (island.pixel_count < in_min_island)
+		{
+			++dropped;
+			continue;
+		}
+
+		boundings = boundings.get_union(island.bounds);
+	}
+
+	if (dropped > 0)
+	{
+		spdlog::debug("Dropped {} islands smaller than {} pixels in {}", dropped, in_min_island, m_file_path);
+	}
+
+	return boundings;
+}
+
+auto image::label_components() const -> std::vector<component>
+{
+	if (!has_alpha())
+	{
+		return {{m_rect, static_cast<size_t>(m_rect.get_width()) * static_cast<size_t>(m_rect.get_height())}};
+	}
+
+	// Horizontal run of opaque pixels, both ends inclusive
+	struct run
+	{
+		int32_t x_left;
+		int32_t x_right;
+		int32_t y;
+	};
+
+	const auto scanner = get_alpha_scan();
+	const auto width   = m_rect.get_width();
+
+	std::vector<run> runs;
+	std::vector<uint32_t> parents;
+
+	auto find_root = [&parents](uint32_t in_idx) -> uint32_t
+	{
+		while (parents[in_idx] != in_idx)
+		{
+			parents[in_idx] = parents[parents[in_idx]];
+			in_idx			= parents[in_idx];
+		}
+
+		return in_idx;
+	};
+
+	size_t prev_begin = 0;
+	size_t prev_end	  = 0;
+
 	for (int32_t pos_y = 0; pos_y < m_rect.get_height(); ++pos_y)
 	{
-		for (int32_t pos_x = 0; pos_x < m_rect.get_width(); ++pos_x)
+		const uint8_t* ptr_row = get_row(pos_y);
+		const size_t row_begin = runs.size();
+
+		// Runs of the previous row are sorted by x, so one cursor is enough to find the overlapping ones
+		size_t cursor = prev_begin;
+
+		for (int32_t pos_x = is_clear_row(pos_y) ? -1 : scanner.find_first(ptr_row, 0, width); pos_x >= 0; pos_x = scanner.find_first(ptr_row, pos_x, width))
 		{
-			const auto alpha = m_data[(pos_y * m_rect.get_width() + pos_x) * m_channels + 3];
+			int32_t x_right = pos_x;
+			while (x_right + 1 < width && scanner.is_opaque(ptr_row, x_right + 1))
+			{
+				++x_right;
+			}
+
+			const auto idx = static_cast<uint32_t>(runs.size());
+			runs.push_back({pos_x, x_right, pos_y});
+			parents.push_back(idx);
+
+			while (cursor < prev_end && runs[cursor].x_right < pos_x)
+			{
+				++cursor;
+			}
 
-			if (alpha > 0)
+			for (size_t above = cursor; above < prev_end && runs[above].x_left <= x_right; ++above)
 			{
-				x_min = std::min(x_min, pos_x);
-				x_max = std::max(x_max, pos_x);
-				y_min = std::min(y_min, pos_y);
-				y_max = std::max(y_max, pos_y);
+				const auto root_above = find_root(static_cast<uint32_t>(above));
+				const auto root_self  = find_root(idx);
+
+				parents[std::max(root_above, root_self)] = std::min(root_above, root_self);
 			}
+
+			pos_x = x_right + 1;
 		}
+
+		prev_begin = row_begin;
+		prev_end   = runs.size();
 	}
 
-	m_trim_rect.set_x(x_min);
-	m_trim_rect.set_y(y_min);
-	m_trim_rect.set_width(x_max - x_min + 1);
-	m_trim_rect.set_height(y_max - y_min + 1);
+	std::vector<component> components;
+	std::vector<uint32_t> labels(runs.size(), std::numeric_limits<uint32_t>::max());
 
-	return m_trim_rect;
+	for (size_t idx = 0; idx < runs.size(); ++idx)
+	{
+		const auto& current = runs[idx];
+		const auto root		= find_root(static_cast<uint32_t>(idx));
+
+		if (labels[root] == std::numeric_limits<uint32_t>::max())
+		{
+			labels[root] = static_cast<uint32_t>(components.size());
+			components.push_back({rect{}, 0});
+		}
+
+		auto& island = components[labels[root]];
+
+		island.bounds = island.bounds.get_union({current.x_left, current.y, current.x_right + 1, current.y + 1});
+		island.pixel_count += static_cast<size_t>(current.x_right - current.x_left + 1);
+	}
+
+	return components;
+}
+
+auto image::get_alpha_scan() const -> alpha_scan
+{
+	if (m_is_alpha_plane)
+	{
+		return {1, 0};
+	}
+
+	return {m_channels, m_channels - 1};
+}
+
+auto image::get_row(int32_t in_y) const -> const uint8_t* { return m_data.data() + static_cast<size_t>(in_y) * static_cast<size_t>(m_rect.get_width()) * get_pixel_size(); }
+
+auto image::get_reader_size() const -> size_t
+{
+	const auto stride = static_cast<size_t>(m_rect.get_width()) * m_channels;
+
+	// libjpeg keeps an iMCU row of up to 16 lines for the upsampling next to the row handed out
+	if (uses_libjpeg())
+	{
+		return stride * 17;
+	}
+
+	// Two scanlines with their filter bytes and the compressed input window
+	return (stride + 1) * 2 + size_t{64} * 1024;
+}
+
+auto image::copy_crop_row(const uint8_t* ptr_src_row, const rect& in_rect, uint8_t* ptr_dst_row) const -> void
+{
+	// Columns of the crop outside the image stay transparent
+	const auto x_begin = std::max(in_rect.get_x(), 0);
+	const auto x_end   = std::min(in_rect.get_x() + in_rect.get_width(), m_rect.get_width());
+
+	if (x_begin >= x_end)
+	{
+		return;
+	}
+
+	std::copy(ptr_src_row + static_cast<size_t>(x_begin) * m_channels, ptr_src_row + static_cast<size_t>(x_end) * m_channels,
+			  ptr_dst_row + static_cast<size_t>(x_begin - in_rect.get_x()) * m_channels);
 }
 
 auto image::write_data(std::vector<uint8_t>& out_data, const rect& in_rect) -> void
 {
-	const auto new_x	  = static_cast<size_t>(in_rect.get_x());
-	const auto new_y	  = static_cast<size_t>(in_rect.get_y());
-	const auto new_width  = static_cast<size_t>(in_rect.get_width());
-	const auto new_height = static_cast<size_t>(in_rect.get_height());
+	const auto new_stride = static_cast<size_t>(in_rect.get_width()) * m_channels;
 
-	const auto old_width = m_rect.get_width();
+	const auto y_begin = std::max(in_rect.get_y(), 0);
+	const auto y_end   = std::min(in_rect.get_y() + in_rect.get_height(), m_rect.get_height());
 
-	size_t old_index = 0;
-	size_t new_index = 0;
+	for (int32_t pos_y = y_begin; pos_y < y_end; ++pos_y)
+	{
+		copy_crop_row(get_row(pos_y), in_rect, out_data.data() + static_cast<size_t>(pos_y - in_rect.get_y()) * new_stride);
+	}
+}
 
-	for (size_t pos_y = 0; pos_y < new_height; ++pos_y)
+auto image::stream_data(std::vector<uint8_t>& out_data, const rect& in_rect) -> void
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	png_reader reader(m_file_path);
+
+	const auto new_stride = static_cast<size_t>(in_rect.get_width()) * m_channels;
+	const auto y_end	  = std::min(in_rect.get_y() + in_rect.get_height(), m_rect.get_height());
+
+	// Rows above the crop still have to be unfiltered since the next row may refer to them, rows below are never inflated
+	while (reader.get_next_row() < y_end)
 	{
-		old_index = ((new_y + pos_y) * old_width + new_x) * m_channels;
-		new_index = pos_y * new_width * m_channels;
+		const auto pos_y	   = reader.get_next_row();
+		const uint8_t* ptr_row = reader.read_row();
 
-		std::copy(m_data.begin() + static_cast<ptrdiff_t>(old_index), m_data.begin() + static_cast<ptrdiff_t>(old_index + new_width * m_channels),
-				  out_data.begin() + static_cast<ptrdiff_t>(new_index));
+		if (pos_y >= in_rect.get_y())
+		{
+			copy_crop_row(ptr_row, in_rect, out_data.data() + static_cast<size_t>(pos_y - in_rect.get_y()) * new_stride);
+		}
 	}
+
+	decoder_registry::record_decode(image_decoder::png_rows, static_cast<size_t>(reader.get_next_row()) * reader.get_stride(), start);
 }
+
 image::image(const std::string_view& file_path) : m_file_path(file_path)
 {
-	int32_t width;
-	int32_t height;
-	int32_t channels;
-	uint8_t* ptr_data = stbi_load(m_file_path.c_str(), &width, &height, &channels, 0);
-
-	if (ptr_data == nullptr)
+	// Only the header is read here, the pixels are decoded by load()
+	m_format = decoder_registry::sniff(m_file_path);
+	if (!decoder_registry::can_decode(m_format))
 	{
-		throw std::runtime_error("Failed to load image: " + m_file_path);
+		throw std::runtime_error(std::string("No decoder for ") + decoder_registry::get_format_name(m_format) + " file: " + m_file_path);
 	}
 
-	const size_t new_data_size = static_cast<size_t>(width * height) * channels;
-	m_data.resize(new_data_size);
+	const auto header = decoder_registry::read_header(m_file_path, m_format);
 
-	std::memcpy(m_data.data(), ptr_data, new_data_size);
-	stbi_image_free(ptr_data);
+	m_channels = header.channels;
+	m_rect.set_x(0);
+	m_rect.set_y(0);
+	m_rect.set_width(header.width);
+	m_rect.set_height(header.height);
+
+	m_is_streamable = m_format == image_format::png && png_reader::can_read(m_file_path);
+	m_is_paletted	= m_format == image_format::png && png_reader::is_paletted(m_file_path);
+
+	// The default backend of the format until the caller picks one
+	set_decoder(decoder_registry{}.select(m_format));
+}
+
+auto image::load() -> void
+{
+	auto decoded = decoder_registry::decode(m_file_path, m_decoder);
 
-	m_channels = static_cast<size_t>(channels);
+	m_data		 = std::move(decoded.pixels);
+	m_clear_rows = std::move(decoded.clear_rows);
+	m_channels	 = decoded.channels;
 	m_rect.set_x(0);
 	m_rect.set_y(0);
-	m_rect.set_width(width);
-	m_rect.set_height(height);
+	m_rect.set_width(decoded.width);
+	m_rect.set_height(decoded.height);
+
+	m_is_alpha_plane = false;
+}
+
+auto image::load_alpha() -> void
+{
+	release();
+	m_is_alpha_plane = true;
+
+	// The scanners never read the pixels of an image without alpha
+	if (!has_alpha())
+	{
+		return;
+	}
+
+	const auto width  = static_cast<size_t>(m_rect.get_width());
+	const auto height = static_cast<size_t>(m_rect.get_height());
+
+	auto extract_alpha = [this, width](const uint8_t* ptr_src, uint8_t* ptr_dst)
+	{
+		for (size_t pos_x = 0; pos_x < width; ++pos_x)
+		{
+			ptr_dst[pos_x] = ptr_src[pos_x * m_channels + m_channels - 1];
+		}
+	};
+
+	std::vector<uint8_t> plane(width * height);
+
+	// The row reader keeps only two scanlines around, the other backends decode the whole image first
+	if (m_is_streamable)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		png_reader reader(m_file_path);
+
+		m_clear_rows.assign(height, 0);
+
+		// The plane starts out zero, clear rows need no copy
+		for (size_t pos_y = 0; pos_y < height; ++pos_y)
+		{
+			const uint8_t* ptr_row = reader.read_row();
+
+			if (reader.is_row_clear())
+			{
+				m_clear_rows[pos_y] = 1;
+				continue;
+			}
+
+			extract_alpha(ptr_row, plane.data() + pos_y * width);
+		}
+
+		decoder_registry::record_decode(image_decoder::png_rows, width * height * m_channels, start);
+	}
+	else
+	{
+		auto decoded = decoder_registry::decode(m_file_path, m_decoder, m_channels);
+
+		if (decoded.width != m_rect.get_width() || decoded.height != m_rect.get_height())
+		{
+			throw std::runtime_error("Failed to load image: " + m_file_path);
+		}
+
+		m_clear_rows = std::move(decoded.clear_rows);
+
+		for (size_t pos_y = 0; pos_y < height; ++pos_y)
+		{
+			extract_alpha(decoded.pixels.data() + pos_y * width * m_channels, plane.data() + pos_y * width);
+		}
+	}
+
+	m_data.swap(plane);
 }
 
-auto image::rewrite_with_new_rect(const rect& new_rect) -> void
+auto image::release() -> void
 {
+	std::vector<uint8_t>().swap(m_data);
+	std::vector<uint8_t>().swap(m_clear_rows);
+	m_is_alpha_plane = false;
+}
+
+auto image::rewrite_with_new_rect(const rect& new_rect, png_writer& in_writer, jpeg_writer& in_jpeg_writer) -> void
+{
+	// The DCT blocks are copied as they are, nothing is decoded, a crop reaching past the image falls through to the re-encode
+	if (is_jpeg() && in_jpeg_writer.is_lossless() && in_jpeg_writer.write_cropped(m_file_path, new_rect))
+	{
+		return;
+	}
+
 	std::vector<uint8_t> new_data;
-	new_data.resize(static_cast<size_t>(new_rect.get_width() * new_rect.get_height()) * m_channels);
+	new_data.resize(static_cast<size_t>(new_rect.get_width()) * static_cast<size_t>(new_rect.get_height()) * m_channels);
+
+	// Without resident pixels only the rows and columns of the crop are decoded
+	if (is_loaded())
+	{
+		write_data(new_data, new_rect);
+	}
+	else if (m_is_streamable)
+	{
+		stream_data(new_data, new_rect);
+	}
+	else if (uses_libjpeg())
+	{
+		const auto start = std::chrono::steady_clock::now();
+		jpeg_codec::decode_crop(m_file_path, new_rect, m_channels, new_data.data());
+
+		const auto width  = std::clamp(new_rect.get_x() + new_rect.get_width(), 0, m_rect.get_width()) - std::clamp(new_rect.get_x(), 0, m_rect.get_width());
+		const auto height = std::clamp(new_rect.get_y() + new_rect.get_height(), 0, m_rect.get_height()) - std::clamp(new_rect.get_y(), 0, m_rect.get_height());
+		decoder_registry::record_decode(image_decoder::libjpeg, static_cast<size_t>(width) * static_cast<size_t>(height) * m_channels, start);
+	}
+	else
+	{
+		load();
+		write_data(new_data, new_rect);
+		release();
+	}
 
-	write_data(new_data, new_rect);
+	switch (m_format)
+	{
+	case image_format::jpeg:
+		in_jpeg_writer.write(m_file_path, new_data.data(), new_rect.get_width(), new_rect.get_height(), m_channels);
+		return;
+	case image_format::qoi:
+		save_file(m_file_path, qoi_codec::encode(new_data.data(), new_rect.get_width(), new_rect.get_height(), m_channels));
+		return;
+	case image_format::webp:
+		save_file(m_file_path, webp_codec::encode(new_data.data(), new_rect.get_width(), new_rect.get_height(), m_channels, webp_codec::is_lossy(m_file_path)));
+		return;
+	default:
+		break;
+	}
 
-	stbi_write_png(m_file_path.c_str(), new_rect.get_width(), new_rect.get_height(), static_cast<int32_t>(m_channels), new_data.data(),
-				   static_cast<int32_t>(new_rect.get_width() * m_channels));
+	in_writer.write(m_file_path, new_data.data(), new_rect.get_width(), new_rect.get_height(), m_channels);
+}
+
+auto image::get_trim_size(const rect& in_rect) const -> size_t
+{
+	const auto crop_size = static_cast<size_t>(in_rect.get_width()) * static_cast<size_t>(in_rect.get_height()) * m_channels;
+
+	return crop_size + (m_is_streamable || uses_libjpeg() ? get_reader_size() : get_load_size());
+}
+
+auto image::get_plane_load_size() const -> size_t
+{
+	if (!has_alpha())
+	{
+		return 0;
+	}
+
+	return get_plane_size() + (m_is_streamable ? get_reader_size() : get_decoded_size());
 }
 
 auto image::perform_compresion() -> void
 {
-	if (m_extension == ".png")
+	switch (m_format)
 	{
+	case image_format::png:
 		compress_png(m_file_path);
+		break;
+	case image_format::jpeg:
+		compress_jpeg(m_file_path);
+		break;
+	default:
+		spdlog::debug("No compressor for {} files, skipping {}", decoder_registry::get_format_name(m_format), m_file_path);
+		break;
 	}
-	else if (m_extension == ".jpg" || m_extension == ".jpeg")
+}
+
+auto image::quantize(png_writer& in_writer) -> void
+{
+	if (m_format != image_format::png)
 	{
-		compress_jpeg(m_file_path);
+		perform_compresion();
+		return;
 	}
-	else
+
+	const auto file_size  = static_cast<size_t>(std::filesystem::file_size(m_file_path));
+	const bool was_loaded = is_loaded();
+
+	// Paletted files are settled from the header alone, without decoding, unless they are over their byte budget or a shared palette has to replace theirs
+	const bool is_shared = in_writer.has_shared_palette();
+	if (m_is_paletted && !is_shared && !in_writer.precheck(m_file_path, nullptr, m_rect.get_width(), m_rect.get_height(), m_channels, file_size, true))
+	{
+		return;
+	}
+
+	if (!was_loaded)
 	{
-		spdlog::error("Unsupported extension: {}", m_extension);
+		load();
+	}
+
+	if (is_shared || m_is_paletted || in_writer.precheck(m_file_path, m_data.data(), m_rect.get_width(), m_rect.get_height(), m_channels, file_size, false))
+	{
+		in_writer.write_quantized(m_file_path, m_data.data(), m_rect.get_width(), m_rect.get_height(), m_channels, file_size);
+	}
+
+	if (!was_loaded)
+	{
+		release();
 	}
 }
 
-auto image::get_image_boundings(uint8_t idx_algorithm) -> rect
+auto image::precheck(png_writer& in_writer) -> bool
 {
+	const auto file_size = static_cast<size_t>(std::filesystem::file_size(m_file_path));
+	if (m_is_paletted)
+	{
+		return in_writer.precheck(m_file_path, nullptr, m_rect.get_width(), m_rect.get_height(), m_channels, file_size, true);
+	}
+
+	const bool was_loaded = is_loaded();
+	if (!was_loaded)
+	{
+		load();
+	}
+
+	const bool result = in_writer.precheck(m_file_path, m_data.data(), m_rect.get_width(), m_rect.get_height(), m_channels, file_size, false);
+
+	if (!was_loaded)
+	{
+		release();
+	}
+
+	return result;
+}
+
+auto image::get_image_boundings(uint8_t idx_algorithm, size_t in_min_island) -> rect
+{
+	if (m_is_scanned)
+	{
+		return m_trim_rect;
+	}
+
 	switch (idx_algorithm)
 	{
 	case 0:
-		return flood_fill();
+		m_trim_rect = flood_fill();
+		break;
+	case 2:
+		m_trim_rect = edge_inward();
+		break;
+	case 3:
+		m_trim_rect = island_algo(in_min_island);
+		break;
 	default:
-		return std_algo();
+		m_trim_rect = std_algo();
+		break;
 	}
-}
+
+	m_is_scanned = true;
+
+	return m_trim_rect;
+}
\ No newline at end of file
@@ -0,0 +1,525 @@
+#include "jpeg.hpp"
+
+#include <algorithm>
+#include <array>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+// jpeglib.h needs FILE and size_t declared first
+#include <jpeglib.h>
+#include <spdlog/spdlog.h>
+
+#include "file_sink.hpp"
+
+namespace
+{
+	constexpr std::array<uint8_t, 3> jpeg_signature = {0xFF, 0xD8, 0xFF};
+
+	// EXIF and ICC, everything the display of the image depends on
+	constexpr std::array<int32_t, 2> kept_markers = {JPEG_APP0 + 1, JPEG_APP0 + 2};
+
+	struct error_handler
+	{
+		jpeg_error_mgr manager;
+		std::jmp_buf jump;
+		std::array<char, JMSG_LENGTH_MAX> message;
+	};
+
+	[[noreturn]] auto on_error(j_common_ptr ptr_info) -> void
+	{
+		auto* ptr_handler = reinterpret_cast<error_handler*>(ptr_info->err);
+		(*ptr_info->err->format_message)(ptr_info, ptr_handler->message.data());
+
+		std::longjmp(ptr_handler->jump, 1);
+	}
+
+	// Warnings such as recovered corrupt data would otherwise go straight to stderr
+	auto on_message(j_common_ptr ptr_info) -> void
+	{
+		std::array<char, JMSG_LENGTH_MAX> message{};
+		(*ptr_info->err->format_message)(ptr_info, message.data());
+
+		spdlog::debug("libjpeg: {}", message.data());
+	}
+
+	auto init_handler(error_handler& out_handler) -> jpeg_error_mgr*
+	{
+		auto* ptr_manager		   = jpeg_std_error(&out_handler.manager);
+		ptr_manager->error_exit	   = on_error;
+		ptr_manager->output_message = on_message;
+
+		return ptr_manager;
+	}
+
+	// Runs in_work with error_exit jumping back here, so in_work must not hold objects with destructors across libjpeg calls
+	template <typename work> auto guarded(error_handler& in_handler, const std::string& in_context, work&& in_work) -> void
+	{
+		if (setjmp(in_handler.jump) != 0)
+		{
+			throw std::runtime_error(in_context + ": " + in_handler.message.data());
+		}
+
+		in_work();
+	}
+
+	// Both structs are destroyed on every exit path, also after an error left them mid decode
+	struct decompressor
+	{
+		error_handler handler{};
+		jpeg_decompress_struct info{};
+
+		decompressor()
+		{
+			info.err = init_handler(handler);
+			jpeg_create_decompress(&info);
+		}
+
+		~decompressor() { jpeg_destroy_decompress(&info); }
+
+		decompressor(const decompressor&)					 = delete;
+		decompressor(decompressor&&)						 = delete;
+		auto operator=(const decompressor&) -> decompressor& = delete;
+	};
+
+	struct compressor
+	{
+		error_handler handler{};
+		jpeg_compress_struct info{};
+
+		// The destination buffer is malloc'ed by libjpeg and grown as the encode goes
+		unsigned char* ptr_buffer{nullptr};
+		unsigned long buffer_size{0};
+
+		compressor()
+		{
+			info.err = init_handler(handler);
+			jpeg_create_compress(&info);
+			jpeg_mem_dest(&info, &ptr_buffer, &buffer_size);
+		}
+
+		~compressor()
+		{
+			jpeg_destroy_compress(&info);
+			std::free(ptr_buffer);
+		}
+
+		compressor(const compressor&)					 = delete;
+		compressor(compressor&&)						 = delete;
+		auto operator=(const compressor&) -> compressor& = delete;
+
+		[[nodiscard]] auto get_output() const -> std::vector<uint8_t> { return {ptr_buffer, ptr_buffer + buffer_size}; }
+	};
+
+	struct marker
+	{
+		int32_t code;
+		std::vector<uint8_t> data;
+	};
+
+	using file_handle = std::unique_ptr<FILE, decltype(&std::fclose)>;
+
+	auto open_file(const std::string& in_file_path) -> file_handle
+	{
+		file_handle file(std::fopen(in_file_path.c_str(), "rb"), &std::fclose);
+		if (file == nullptr)
+		{
+			throw std::runtime_error("Failed to open JPEG: " + in_file_path);
+		}
+
+		return file;
+	}
+
+	// libjpeg converts every colour space it knows to RGB, CMYK would need a colour profile
+	auto set_output_space(jpeg_decompress_struct& in_info, const std::string& in_file_path) -> void
+	{
+		if (in_info.jpeg_color_space == JCS_CMYK || in_info.jpeg_color_space == JCS_YCCK)
+		{
+			throw std::runtime_error("Unsupported CMYK JPEG: " + in_file_path);
+		}
+
+		in_info.out_color_space = in_info.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	}
+
+	auto save_markers(jpeg_decompress_struct& in_info) -> void
+	{
+		for (const auto code : kept_markers)
+		{
+			jpeg_save_markers(&in_info, code, 0xFFFF);
+		}
+	}
+
+	auto collect_markers(const jpeg_decompress_struct& in_info) -> std::vector<marker>
+	{
+		std::vector<marker> markers;
+		for (auto* ptr_marker = in_info.marker_list; ptr_marker != nullptr; ptr_marker = ptr_marker->next)
+		{
+			markers.push_back({ptr_marker->marker, {ptr_marker->data, ptr_marker->data + ptr_marker->data_length}});
+		}
+
+		return markers;
+	}
+
+	// Markers of the file about to be replaced, a file that is missing or not a JPEG has none
+	auto read_markers(const std::string& in_file_path) -> std::vector<marker>
+	{
+		if (!jpeg_codec::can_read(in_file_path))
+		{
+			return {};
+		}
+
+		const auto file = open_file(in_file_path);
+		decompressor decoder;
+
+		std::vector<marker> markers;
+		guarded(decoder.handler, "Failed to read JPEG markers " + in_file_path,
+				[&]()
+				{
+					jpeg_stdio_src(&decoder.info, file.get());
+					save_markers(decoder.info);
+					jpeg_read_header(&decoder.info, TRUE);
+				});
+
+		return collect_markers(decoder.info);
+	}
+
+	auto write_markers(jpeg_compress_struct& in_info, const std::vector<marker>& in_markers) -> void
+	{
+		for (const auto& entry : in_markers)
+		{
+			jpeg_write_marker(&in_info, entry.code, entry.data.data(), static_cast<uint32_t>(entry.data.size()));
+		}
+	}
+
+	auto round_up(JDIMENSION in_value, int32_t in_multiple) -> JDIMENSION
+	{
+		const auto multiple = static_cast<JDIMENSION>(in_multiple);
+		return (in_value + multiple - 1) / multiple * multiple;
+	}
+
+	// Blocks of the component that cover in_pixels of the image, the same rounding libjpeg applies to width_in_blocks
+	auto get_blocks(JDIMENSION in_pixels, int32_t in_samp_factor, int32_t in_max_samp_factor) -> JDIMENSION
+	{
+		const auto block_pixels = static_cast<JDIMENSION>(in_max_samp_factor * DCTSIZE);
+		return (in_pixels * static_cast<JDIMENSION>(in_samp_factor) + block_pixels - 1) / block_pixels;
+	}
+} // namespace
+
+auto jpeg_codec::can_read(const std::string& in_file_path) -> bool
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+
+	std::array<uint8_t, 3> signature{};
+	file.read(reinterpret_cast<char*>(signature.data()), signature.size());
+
+	return file && signature == jpeg_signature;
+}
+
+auto jpeg_codec::decode(const std::string& in_file_path) -> pixel_buffer
+{
+	const auto file = open_file(in_file_path);
+	decompressor decoder;
+
+	pixel_buffer result{};
+	guarded(decoder.handler, "Failed to decode JPEG " + in_file_path,
+			[&]()
+			{
+				jpeg_stdio_src(&decoder.info, file.get());
+				jpeg_read_header(&decoder.info, TRUE);
+				set_output_space(decoder.info, in_file_path);
+				jpeg_start_decompress(&decoder.info);
+
+				result.width	= static_cast<int32_t>(decoder.info.output_width);
+				result.height	= static_cast<int32_t>(decoder.info.output_height);
+				result.channels = static_cast<size_t>(decoder.info.output_components);
+				result.pixels.resize(static_cast<size_t>(result.width) * static_cast<size_t>(result.height) * result.channels);
+
+				const auto stride = static_cast<size_t>(result.width) * result.channels;
+				while (decoder.info.output_scanline < decoder.info.output_height)
+				{
+					JSAMPROW ptr_row = result.pixels.data() + decoder.info.output_scanline * stride;
+					jpeg_read_scanlines(&decoder.info, &ptr_row, 1);
+				}
+
+				jpeg_finish_decompress(&decoder.info);
+			});
+
+	return result;
+}
+
+auto jpeg_codec::decode_crop(const std::string& in_file_path, const rect& in_rect, size_t in_channels, uint8_t* ptr_out) -> void
+{
+	const auto file = open_file(in_file_path);
+	decompressor decoder;
+
+	std::vector<uint8_t> row;
+	guarded(decoder.handler, "Failed to decode JPEG " + in_file_path,
+			[&]()
+			{
+				jpeg_stdio_src(&decoder.info, file.get());
+				jpeg_read_header(&decoder.info, TRUE);
+				set_output_space(decoder.info, in_file_path);
+				jpeg_start_decompress(&decoder.info);
+
+				if (static_cast<size_t>(decoder.info.output_components) != in_channels)
+				{
+					throw std::runtime_error("JPEG channel count changed: " + in_file_path);
+				}
+
+				const auto width   = static_cast<int32_t>(decoder.info.output_width);
+				const auto height  = static_cast<int32_t>(decoder.info.output_height);
+				const auto x_begin = std::clamp(in_rect.get_x(), 0, width);
+				const auto x_end   = std::clamp(in_rect.get_x() + in_rect.get_width(), 0, width);
+				const auto y_begin = std::clamp(in_rect.get_y(), 0, height);
+				const auto y_end   = std::clamp(in_rect.get_y() + in_rect.get_height(), 0, height);
+
+				if (x_begin >= x_end || y_begin >= y_end)
+				{
+					jpeg_abort_decompress(&decoder.info);
+					return;
+				}
+
+				// The crop widens to whole iMCU columns, x_offset tells where the decoded rows now start
+				auto x_offset	 = static_cast<JDIMENSION>(x_begin);
+				auto crop_width = static_cast<JDIMENSION>(x_end - x_begin);
+				jpeg_crop_scanline(&decoder.info, &x_offset, &crop_width);
+
+				row.resize(static_cast<size_t>(decoder.info.output_width) * in_channels);
+				jpeg_skip_scanlines(&decoder.info, static_cast<JDIMENSION>(y_begin));
+
+				const auto out_stride = static_cast<size_t>(in_rect.get_width()) * in_channels;
+				const auto copy_begin = static_cast<size_t>(x_begin - static_cast<int32_t>(x_offset)) * in_channels;
+				const auto copy_size  = static_cast<size_t>(x_end - x_begin) * in_channels;
+
+				while (decoder.info.output_scanline < static_cast<JDIMENSION>(y_end))
+				{
+					const auto pos_y = static_cast<int32_t>(decoder.info.output_scanline);
+
+					JSAMPROW ptr_row = row.data();
+					jpeg_read_scanlines(&decoder.info, &ptr_row, 1);
+
+					std::copy_n(row.data() + copy_begin, copy_size, ptr_out + static_cast<size_t>(pos_y - in_rect.get_y()) * out_stride + static_cast<size_t>(x_begin - in_rect.get_x()) * in_channels);
+				}
+
+				// The rows below the crop are never decoded
+				jpeg_abort_decompress(&decoder.info);
+			});
+}
+
+auto jpeg_codec::encode(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, int32_t in_quality,
+						bool in_progressive) -> std::vector<uint8_t>
+{
+	if (in_channels != 1 && in_channels != 3)
+	{
+		throw std::runtime_error("JPEG needs grey or RGB pixels: " + in_file_path);
+	}
+
+	const auto markers = read_markers(in_file_path);
+	const auto stride  = static_cast<size_t>(in_width) * in_channels;
+
+	compressor encoder;
+	guarded(encoder.handler, "Failed to encode JPEG " + in_file_path,
+			[&]()
+			{
+				encoder.info.image_width	  = static_cast<JDIMENSION>(in_width);
+				encoder.info.image_height	  = static_cast<JDIMENSION>(in_height);
+				encoder.info.input_components = static_cast<int32_t>(in_channels);
+				encoder.info.in_color_space	  = in_channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+				jpeg_set_defaults(&encoder.info);
+				jpeg_set_quality(&encoder.info, in_quality, TRUE);
+				encoder.info.optimize_coding = TRUE;
+
+				if (in_progressive)
+				{
+					jpeg_simple_progression(&encoder.info);
+				}
+
+				jpeg_start_compress(&encoder.info, TRUE);
+				write_markers(encoder.info, markers);
+
+				while (encoder.info.next_scanline < encoder.info.image_height)
+				{
+					auto* ptr_row = const_cast<JSAMPROW>(ptr_pixels + encoder.info.next_scanline * stride);
+					jpeg_write_scanlines(&encoder.info, &ptr_row, 1);
+				}
+
+				jpeg_finish_compress(&encoder.info);
+			});
+
+	return encoder.get_output();
+}
+
+auto jpeg_codec::optimize(const std::string& in_file_path) -> std::vector<uint8_t>
+{
+	const auto file = open_file(in_file_path);
+	decompressor decoder;
+	compressor encoder;
+
+	// One handler serves both structs, so an error in either lands in the same place
+	decoder.info.err = &encoder.handler.manager;
+
+	std::vector<marker> markers;
+	guarded(encoder.handler, "Failed to optimize JPEG " + in_file_path,
+			[&]()
+			{
+				jpeg_stdio_src(&decoder.info, file.get());
+				save_markers(decoder.info);
+				jpeg_read_header(&decoder.info, TRUE);
+
+				auto* ptr_coefficients = jpeg_read_coefficients(&decoder.info);
+				markers				   = collect_markers(decoder.info);
+
+				jpeg_copy_critical_parameters(&decoder.info, &encoder.info);
+				encoder.info.optimize_coding = TRUE;
+				jpeg_simple_progression(&encoder.info);
+
+				jpeg_write_coefficients(&encoder.info, ptr_coefficients);
+				write_markers(encoder.info, markers);
+
+				jpeg_finish_compress(&encoder.info);
+				jpeg_finish_decompress(&decoder.info);
+			});
+
+	return encoder.get_output();
+}
+
+auto jpeg_codec::get_mcu_size(const std::string& in_file_path) -> mcu_size
+{
+	const auto file = open_file(in_file_path);
+	decompressor decoder;
+
+	mcu_size result{};
+	guarded(decoder.handler, "Failed to read JPEG header " + in_file_path,
+			[&]()
+			{
+				jpeg_stdio_src(&decoder.info, file.get());
+				jpeg_read_header(&decoder.info, TRUE);
+
+				result.width  = decoder.info.max_h_samp_factor * DCTSIZE;
+				result.height = decoder.info.max_v_samp_factor * DCTSIZE;
+			});
+
+	return result;
+}
+
+auto jpeg_codec::crop_lossless(const std::string& in_file_path, const rect& in_rect, bool in_progressive) -> std::vector<uint8_t>
+{
+	const auto file = open_file(in_file_path);
+	decompressor decoder;
+	compressor encoder;
+
+	decoder.info.err = &encoder.handler.manager;
+
+	bool is_inside = true;
+	std::vector<marker> markers;
+	guarded(encoder.handler, "Failed to crop JPEG " + in_file_path,
+			[&]()
+			{
+				jpeg_stdio_src(&decoder.info, file.get());
+				save_markers(decoder.info);
+				jpeg_read_header(&decoder.info, TRUE);
+
+				const auto max_h = decoder.info.max_h_samp_factor;
+				const auto max_v = decoder.info.max_v_samp_factor;
+				const auto x_end = in_rect.get_x() + in_rect.get_width();
+				const auto y_end = in_rect.get_y() + in_rect.get_height();
+
+				if (in_rect.get_x() < 0 || in_rect.get_y() < 0 || x_end > static_cast<int32_t>(decoder.info.image_width) || y_end > static_cast<int32_t>(decoder.info.image_height) ||
+					in_rect.get_width() <= 0 || in_rect.get_height() <= 0)
+				{
+					is_inside = false;
+					jpeg_abort_decompress(&decoder.info);
+					return;
+				}
+
+				const auto x_mcus	   = static_cast<JDIMENSION>(in_rect.get_x() / (max_h * DCTSIZE));
+				const auto y_mcus	   = static_cast<JDIMENSION>(in_rect.get_y() / (max_v * DCTSIZE));
+				const auto crop_width  = static_cast<JDIMENSION>(x_end) - x_mcus * static_cast<JDIMENSION>(max_h * DCTSIZE);
+				const auto crop_height = static_cast<JDIMENSION>(y_end) - y_mcus * static_cast<JDIMENSION>(max_v * DCTSIZE);
+
+				// The arrays of the crop have to be requested before the coefficients are read, that is when libjpeg allocates them
+				std::array<jvirt_barray_ptr, MAX_COMPONENTS> crop_arrays{};
+				for (int32_t idx = 0; idx < decoder.info.num_components; ++idx)
+				{
+					const auto& component = decoder.info.comp_info[idx];
+					crop_arrays[idx]	  = (*decoder.info.mem->request_virt_barray)(reinterpret_cast<j_common_ptr>(&decoder.info), JPOOL_IMAGE, FALSE,
+																				 round_up(get_blocks(crop_width, component.h_samp_factor, max_h), component.h_samp_factor),
+																				 round_up(get_blocks(crop_height, component.v_samp_factor, max_v), component.v_samp_factor),
+																				 static_cast<JDIMENSION>(component.v_samp_factor));
+				}
+
+				auto* ptr_coefficients = jpeg_read_coefficients(&decoder.info);
+				markers				   = collect_markers(decoder.info);
+
+				jpeg_copy_critical_parameters(&decoder.info, &encoder.info);
+				encoder.info.image_width	 = crop_width;
+				encoder.info.image_height	 = crop_height;
+				encoder.info.optimize_coding = TRUE;
+
+				if (in_progressive)
+				{
+					jpeg_simple_progression(&encoder.info);
+				}
+
+				jpeg_write_coefficients(&encoder.info, crop_arrays.data());
+				write_markers(encoder.info, markers);
+
+				// Whole iMCU rows of blocks, the partial iMCUs at the far edges are padded by the encoder
+				for (int32_t idx = 0; idx < decoder.info.num_components; ++idx)
+				{
+					const auto& component = decoder.info.comp_info[idx];
+					const auto rows		  = static_cast<JDIMENSION>(component.v_samp_factor);
+					const auto x_blocks	  = x_mcus * static_cast<JDIMENSION>(component.h_samp_factor);
+					const auto y_blocks	  = y_mcus * rows;
+					const auto width	  = get_blocks(crop_width, component.h_samp_factor, max_h);
+					const auto height	  = get_blocks(crop_height, component.v_samp_factor, max_v);
+
+					for (JDIMENSION pos_y = 0; pos_y < height; pos_y += rows)
+					{
+						auto* ptr_dst = (*decoder.info.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&decoder.info), crop_arrays[idx], pos_y, rows, TRUE);
+						auto* ptr_src = (*decoder.info.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&decoder.info), ptr_coefficients[idx], pos_y + y_blocks, rows, FALSE);
+
+						for (JDIMENSION row = 0; row < rows; ++row)
+						{
+							std::memcpy(ptr_dst[row], ptr_src[row] + x_blocks, width * sizeof(JBLOCK));
+						}
+					}
+				}
+
+				jpeg_finish_compress(&encoder.info);
+				jpeg_finish_decompress(&decoder.info);
+			});
+
+	return is_inside ? encoder.get_output() : std::vector<uint8_t>{};
+}
+
+jpeg_writer::jpeg_writer(int32_t in_quality) : m_quality(std::clamp(in_quality, 1, 100)) {}
+
+auto jpeg_writer::write(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> void
+{
+	// Encoded in memory first, a failed encode leaves the original in place
+	const auto encoded = jpeg_codec::encode(in_file_path, ptr_pixels, in_width, in_height, in_channels, m_quality, m_progressive);
+
+	m_raw_bytes += static_cast<size_t>(in_width) * static_cast<size_t>(in_height) * in_channels;
+	m_encoded_bytes += save_file(in_file_path, encoded);
+	++m_files;
+}
+
+auto jpeg_writer::write_cropped(const std::string& in_file_path, const rect& in_rect) -> bool
+{
+	const auto cropped = jpeg_codec::crop_lossless(in_file_path, in_rect, m_progressive);
+	if (cropped.empty())
+	{
+		return false;
+	}
+
+	m_lossless_bytes += save_file(in_file_path, cropped);
+	++m_lossless_files;
+
+	return true;
+}
@@ -19,14 +19,13 @@ auto gather_file_paths(const std::filesystem::path& in_path, const std::string&
 
 		if (entry.is_regular_file())
 		{
-			const auto& path	 = entry.path();
-			const auto extension = path.extension().string();
-			const auto filename	 = path.filename().string();
+			const auto& path	= entry.path();
+			const auto filename = path.filename().string();
 
-			// If doenst match the regex, skip the file
-			if (!std::regex_match(extension, std::regex(".*\\.(png|jpg|jpeg)")))
+			// Formats are told apart by their magic bytes, whatever the extension says
+			if (decoder_registry::sniff(path.string()) == image_format::unknown)
 			{
-				spdlog::trace("Skipping no regex match: {}", path.string());
+				spdlog::trace("Skipping unknown format: {}", path.string());
 				continue;
 			}
 
@@ -45,7 +44,7 @@ auto gather_file_paths(const std::filesystem::path& in_path, const std::string&
 	return image_file_paths;
 }
 
-auto populate_images(std::vector<image*>& in_vector, const std::vector<std::string>& in_file_paths) -> void
+auto populate_images(std::vector<image*>& in_vector, const std::vector<std::string>& in_file_paths, const decoder_registry& in_registry) -> void
 {
 	if (in_file_paths.empty())
 	{
@@ -53,13 +52,15 @@ auto populate_images(std::vector<image*>& in_vector, const std::vector<std::stri
 		exit(ENOENT);
 	}
 
+	// Only the headers are read here, decode_images fills in the pixels
 	for (const auto& file_path : in_file_paths)
 	{
 		try
 		{
 			auto* img = new image(file_path);
 
-			img->set_extension(std::filesystem::path(file_path).extension().string());
+			img->set_decoder(in_registry.select(img->get_format()));
+			spdlog::trace("Decoding {} as {} with {}", file_path, decoder_registry::get_format_name(img->get_format()), decoder_registry::get_decoder_name(img->get_decoder()));
 
 			in_vector.push_back(img);
 		}
@@ -70,6 +71,103 @@ auto populate_images(std::vector<image*>& in_vector, const std::vector<std::stri
 	}
 }
 
+auto decode_images(std::vector<image*>& in_vector, thread_pool& in_pool, progress& in_bar, memory_budget& in_budget, const std::function<void(image*)>& in_on_loaded,
+				   bool in_release, bool in_alpha_only) -> void
+{
+	in_bar.set_progress(0);
+	in_bar.set_total(in_vector.size());
+
+	spdlog::info("Decoding images...");
+
+	std::mutex progress_mutex;
+
+	auto load_image = [&](image*& ptr_img)
+	{
+		const bool alpha_only	 = in_alpha_only || ptr_img->prefers_crop_decode();
+		const auto load_size	 = alpha_only ? ptr_img->get_plane_load_size() : ptr_img->get_load_size();
+		const auto resident_size = alpha_only ? ptr_img->get_plane_size() : ptr_img->get_decoded_size();
+
+		try
+		{
+			if (alpha_only)
+			{
+				ptr_img->load_alpha();
+			}
+			else
+			{
+				ptr_img->load();
+			}
+
+			// Lets the caller start working on the image while the other files are still decoding
+			if (in_on_loaded)
+			{
+				in_on_loaded(ptr_img);
+			}
+
+			if (in_release)
+			{
+				ptr_img->release();
+				in_budget.release(load_size);
+			}
+			else
+			{
+				// Only the decoded pixels stay resident until the trim frees them
+				in_budget.release(load_size - resident_size);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			spdlog::error("Failed to load image: {}", e.what());
+			in_budget.release(load_size);
+
+			delete ptr_img;
+			ptr_img = nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(progress_mutex);
+		in_bar.print_progress();
+	};
+
+	std::vector<thread_pool::task> tasks;
+	for (auto& ptr_img : in_vector)
+	{
+		const bool alpha_only = in_alpha_only || ptr_img->prefers_crop_decode();
+		tasks.push_back({ptr_img->get_decoded_size(), [&load_image, &ptr_img]() { load_image(ptr_img); }, alpha_only ? ptr_img->get_plane_load_size() : ptr_img->get_load_size()});
+	}
+
+	// Admission happens here before each task is queued, a worker never waits on the budget
+	in_pool.run(std::move(tasks), &in_budget);
+
+	// Every image decodes in its own slot, dropping the failed ones keeps the input order
+	in_vector.erase(std::remove(in_vector.begin(), in_vector.end(), nullptr), in_vector.end());
+}
+
+auto get_available_memory() -> size_t
+{
+	std::ifstream meminfo("/proc/meminfo");
+	std::string key;
+	size_t value = 0;
+	std::string unit;
+
+	while (meminfo >> key >> value >> unit)
+	{
+		if (key == "MemAvailable:")
+		{
+			return value * 1024;
+		}
+	}
+
+	const auto pages	 = sysconf(_SC_AVPHYS_PAGES);
+	const auto page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages <= 0 || page_size <= 0)
+	{
+		return std::numeric_limits<size_t>::max();
+	}
+
+	return static_cast<size_t>(pages) * static_cast<size_t>(page_size);
+}
+
 auto get_file_size(const std::vector<std::string>& in_vector) -> double_t
 {
 	double_t total_size = 0;
@@ -82,41 +180,173 @@ auto get_file_size(const std::vector<std::string>& in_vector) -> double_t
 	return total_size;
 }
 
-auto calculate_new_rect(const std::vector<image*>& in_vector, progress& in_bar, uint8_t in_algorithm, bool in_apply_parity) -> rect
+// Row tiles per image, only the row separable algorithms are split and only when there are fewer images than threads
+auto get_row_tiles(size_t in_images, size_t in_threads, uint8_t in_algorithm) -> size_t
+{
+	if ((in_algorithm != 1 && in_algorithm != 2) || in_images == 0 || in_images >= in_threads)
+	{
+		return 1;
+	}
+
+	return (in_threads + in_images - 1) / in_images;
+}
+
+auto get_tile_rows(int32_t in_height, size_t in_tiles) -> int32_t
+{
+	return std::max(static_cast<int32_t>((static_cast<size_t>(in_height) + in_tiles - 1) / in_tiles), 64);
+}
+
+// Union of in_seed and the opaque pixels of one image, a pool task per tile of rows
+auto scan_row_tiles(image* ptr_img, thread_pool& in_pool, size_t in_tiles, const rect& in_seed) -> rect
+{
+	const auto height	 = ptr_img->get_rect().get_height();
+	const auto width	 = static_cast<size_t>(ptr_img->get_rect().get_width());
+	const auto tile_rows = get_tile_rows(height, in_tiles);
+
+	std::mutex union_mutex;
+	rect l_union = in_seed;
+
+	std::vector<thread_pool::task> tasks;
+	for (int32_t pos_y = 0; pos_y < height; pos_y += tile_rows)
+	{
+		const auto y_end = std::min(pos_y + tile_rows, height);
+		tasks.push_back({static_cast<size_t>(y_end - pos_y) * width, [&, pos_y, y_end]()
+						 {
+							 const auto found = ptr_img->grow_boundings(in_seed, pos_y, y_end);
+
+							 std::lock_guard<std::mutex> lock(union_mutex);
+							 l_union = l_union.get_union(found);
+						 }});
+	}
+
+	in_pool.run(std::move(tasks));
+
+	return l_union;
+}
+
+auto calculate_new_rect(const std::vector<image*>& in_vector, thread_pool& in_pool, progress& in_bar, uint8_t in_algorithm, size_t in_min_island, bool in_apply_parity, const mcu_size& in_mcu,
+						bool in_exclusion_scan) -> rect
 {
 	in_bar.set_progress(0);
-	in_bar.set_total(in_vector.size());
 
-	// Initialize the bounding rect with extreme values
 	spdlog::info("Calculating bounding box...");
 
-	int32_t min_x = std::numeric_limits<int32_t>::max();
-	int32_t min_y = std::numeric_limits<int32_t>::max();
-	int32_t max_x = std::numeric_limits<int32_t>::min();
-	int32_t max_y = std::numeric_limits<int32_t>::min();
+	// Flood fill and the island filter look at whole components, so skipping the covered area would change their result
+	if (in_exclusion_scan && (in_algorithm == 0 || in_algorithm == 3))
+	{
+		spdlog::warn("Exclusion scan is not supported by flood fill or island filtering, scanning every image fully");
+		in_exclusion_scan = false;
+	}
 
-	// Iterate over each image's bounding rectangle and find both the smallest and largest bounding box
+	// Nothing can grow the union past the largest image
+	rect canvas;
 	for (const auto& img : in_vector)
 	{
-		const auto& rect = img->get_image_boundings(in_algorithm);
+		canvas = canvas.get_union(img->get_rect());
+	}
+
+	// A batch of rows of one image, images are only split when there are fewer of them than threads
+	struct scan_task
+	{
+		image* ptr_img;
+		int32_t y_begin;
+		int32_t y_end;
+	};
+
+	std::vector<scan_task> tasks;
+
+	const auto num_tiles = get_row_tiles(in_vector.size(), in_pool.get_num_threads(), in_algorithm);
+
+	for (const auto& img : in_vector)
+	{
+		// Images scanned while decoding already hold their result
+		const auto img_tiles = img->is_scanned() ? 1 : num_tiles;
+		const auto height	 = img->get_rect().get_height();
+		const auto tile_rows = get_tile_rows(height, img_tiles);
+
+		for (int32_t pos_y = 0; pos_y < height; pos_y += tile_rows)
+		{
+			tasks.push_back({img, pos_y, std::min(pos_y + tile_rows, height)});
+		}
+	}
 
-		// Update min and max for x and y
-		min_x = std::min(min_x, rect.get_x());
-		min_y = std::min(min_y, rect.get_y());
-		max_x = std::max(max_x, rect.get_x() + rect.get_width());
-		max_y = std::max(max_y, rect.get_y() + rect.get_height());
+	in_bar.set_total(tasks.size());
 
+	std::mutex progress_mutex;
+	std::atomic<bool> covers_canvas{false};
+
+	// Each worker keeps its own union, they are merged once every task is done
+	std::vector<rect> unions(in_pool.get_num_threads() + 1);
+
+	auto scan_task_rows = [&](const scan_task& in_task)
+	{
+		// Skipped tasks still count, the bar has to reach its total
+		if (covers_canvas)
+		{
+			std::lock_guard<std::mutex> lock(progress_mutex);
+			in_bar.print_progress();
+			return;
+		}
+
+		auto& l_union = unions[in_pool.get_worker_index()];
+
+		if (in_task.y_end - in_task.y_begin < in_task.ptr_img->get_rect().get_height())
+		{
+			l_union = in_task.ptr_img->grow_boundings(in_exclusion_scan ? l_union : rect{}, in_task.y_begin, in_task.y_end).get_union(l_union);
+		}
+		else if (in_exclusion_scan && !in_task.ptr_img->is_scanned())
+		{
+			l_union = in_task.ptr_img->grow_boundings(l_union);
+		}
+		else
+		{
+			l_union = l_union.get_union(in_task.ptr_img->get_image_boundings(in_algorithm, in_min_island));
+		}
+
+		std::lock_guard<std::mutex> lock(progress_mutex);
 		in_bar.print_progress();
+
+		if (in_exclusion_scan && l_union.contains(canvas) && !covers_canvas.exchange(true))
+		{
+			spdlog::debug("Union covers the whole canvas, skipping the rest");
+		}
+	};
+
+	std::vector<thread_pool::task> pool_tasks;
+	for (const auto& task : tasks)
+	{
+		const auto cost = static_cast<size_t>(task.y_end - task.y_begin) * static_cast<size_t>(task.ptr_img->get_rect().get_width());
+		pool_tasks.push_back({cost, [&scan_task_rows, &task]() { scan_task_rows(task); }});
 	}
 
-	// Set the bounding box to the calculated min/max values
-	rect l_trim;
-	l_trim.set_x(min_x);
-	l_trim.set_y(min_y);
-	l_trim.set_width(max_x - min_x);
-	l_trim.set_height(max_y - min_y);
+	in_pool.run(std::move(pool_tasks));
 
-	if (in_apply_parity)
+	rect l_union;
+	for (const auto& worker_union : unions)
+	{
+		l_union = l_union.get_union(worker_union);
+	}
+
+	if (l_union.get_area() <= 0)
+	{
+		spdlog::warn("No opaque pixels found, keeping the full canvas");
+		l_union = canvas;
+	}
+
+	rect l_trim = l_union;
+
+	if (in_apply_parity && (in_mcu.width > 1 || in_mcu.height > 1))
+	{
+		// The offsets snap down to the iMCU grid and the far edges stay, every JPEG can then be cropped losslessly to exactly this rect
+		const auto x_end = l_trim.get_x() + l_trim.get_width();
+		const auto y_end = l_trim.get_y() + l_trim.get_height();
+
+		l_trim.set_x(l_trim.get_x() / in_mcu.width * in_mcu.width);
+		l_trim.set_y(l_trim.get_y() / in_mcu.height * in_mcu.height);
+		l_trim.set_width(x_end - l_trim.get_x());
+		l_trim.set_height(y_end - l_trim.get_y());
+	}
+	else if (in_apply_parity)
 	{
 		l_trim.set_x(l_trim.get_x() % 2 == 0 ? l_trim.get_x() : l_trim.get_x() - 1);
 		l_trim.set_y(l_trim.get_y() % 2 == 0 ? l_trim.get_y() : l_trim.get_y() - 1);
@@ -129,13 +359,62 @@ auto calculate_new_rect(const std::vector<image*>& in_vector, progress& in_bar,
 	return l_trim;
 }
 
-auto trim_images(std::vector<image*>& in_vector, progress& in_bar, const rect& in_rect) -> void
+// iMCU grid every JPEG of the batch agrees on, 1 by 1 without JPEGs
+auto get_mcu_alignment(const std::vector<image*>& in_vector) -> mcu_size
+{
+	mcu_size alignment{1, 1};
+	for (const auto* ptr_img : in_vector)
+	{
+		if (!ptr_img->is_jpeg())
+		{
+			continue;
+		}
+
+		try
+		{
+			const auto size	   = jpeg_codec::get_mcu_size(ptr_img->get_file_path());
+			alignment.width	   = std::lcm(alignment.width, size.width);
+			alignment.height = std::lcm(alignment.height, size.height);
+		}
+		catch (const std::exception& e)
+		{
+			spdlog::error("Failed to read the iMCU size: {}", e.what());
+		}
+	}
+
+	return alignment;
+}
+
+auto trim_images(std::vector<image*>& in_vector, thread_pool& in_pool, progress& in_bar, const rect& in_rect, memory_budget& in_budget, png_writer& in_writer,
+				 jpeg_writer& in_jpeg_writer) -> void
 {
 	std::mutex progress_mutex;
 
-	auto trim_image = [&progress_mutex](image* ptr_img, progress& in_bar, const rect& in_rect)
+	// Resident images already hold their decoded pixels in the budget, the streaming pipeline freed them after the scan and decodes the crop again
+	auto get_held_size = [&in_rect, &in_writer, &in_jpeg_writer](const image* ptr_img) -> size_t
+	{
+		const auto pixel_count = static_cast<size_t>(in_rect.get_width()) * static_cast<size_t>(in_rect.get_height());
+		return ptr_img->is_loaded() ? ptr_img->get_decoded_size()
+									: ptr_img->get_trim_size(in_rect) + in_writer.get_working_size(pixel_count, ptr_img->get_channels())
+										  + (ptr_img->is_jpeg() ? in_jpeg_writer.get_working_size(ptr_img->get_decoded_size()) : 0);
+	};
+
+	auto trim_image = [&progress_mutex, &in_budget, &in_bar, &in_rect, &in_writer, &in_jpeg_writer, &get_held_size](image* ptr_img)
 	{
-		ptr_img->rewrite_with_new_rect(in_rect);
+		const auto held_size = get_held_size(ptr_img);
+
+		try
+		{
+			ptr_img->rewrite_with_new_rect(in_rect, in_writer, in_jpeg_writer);
+			ptr_img->release();
+		}
+		catch (const std::exception& e)
+		{
+			spdlog::error("Failed to trim image: {}", e.what());
+		}
+
+		in_budget.release(held_size);
+
 		std::lock_guard<std::mutex> lock(progress_mutex);
 		in_bar.print_progress();
 	};
@@ -143,45 +422,78 @@ auto trim_images(std::vector<image*>& in_vector, progress& in_bar, const rect& i
 	in_bar.set_progress(0);
 	in_bar.set_total(in_vector.size());
 
-	const size_t size_vector = in_vector.size();
+	spdlog::info("Trimming images...");
 
-	// Get number of max threads
-	const auto max_threads = std::thread::hardware_concurrency();
-	const auto num_threads = std::min(max_threads, static_cast<uint32_t>(size_vector));
+	std::vector<thread_pool::task> tasks;
+	for (auto* ptr_img : in_vector)
+	{
+		// Only what the file has to be decoded again for is admitted, the resident pixels are in the budget already
+		tasks.push_back({ptr_img->get_decoded_size(), [&trim_image, ptr_img]() { trim_image(ptr_img); }, ptr_img->is_loaded() ? 0 : get_held_size(ptr_img)});
+	}
 
-	spdlog::info("Trimming images...");
+	in_pool.run(std::move(tasks), &in_budget);
+}
 
-	std::vector<std::future<void>> futures;
-	const size_t chunk_size = size_vector / num_threads;
+// Shares of in_total_bytes in proportion to the pixels each file will hold, capped by in_max_bytes when that is set
+auto split_byte_budget(const std::vector<image*>& in_vector, size_t in_total_bytes, size_t in_max_bytes, bool in_trim) -> std::unordered_map<std::string, size_t>
+{
+	// Every trimmed image is cut to the same rect, so they all get an equal share
+	auto get_area = [in_trim](const image* ptr_img) { return in_trim ? 1.0 : static_cast<double_t>(ptr_img->get_rect().get_width()) * static_cast<double_t>(ptr_img->get_rect().get_height()); };
 
-	for (size_t i = 0; i < num_threads; ++i)
+	double_t total_area = 0;
+	for (const auto* ptr_img : in_vector)
 	{
-		const size_t start = i * chunk_size;
-		const size_t end   = (i + 1 == num_threads) ? size_vector : (i + 1) * chunk_size;
-
-		futures.push_back(std::async(std::launch::async,
-									 [&in_vector, start, end, &in_bar, &trim_image, &in_rect]()
-									 {
-										 for (size_t j = start; j < end; ++j)
-										 {
-											 trim_image(in_vector[j], in_bar, in_rect);
-										 }
-									 }));
+		total_area += get_area(ptr_img);
 	}
 
-	for (auto& future : futures)
+	std::unordered_map<std::string, size_t> budgets;
+	for (const auto* ptr_img : in_vector)
 	{
-		future.get();
+		const auto share = std::max<size_t>(static_cast<size_t>(static_cast<double_t>(in_total_bytes) * get_area(ptr_img) / std::max(total_area, 1.0)), 1);
+		budgets[ptr_img->get_file_path()] = in_max_bytes > 0 ? std::min(share, in_max_bytes) : share;
 	}
+
+	return budgets;
 }
 
-auto compress_images(std::vector<image*>& in_vector, progress& in_bar) -> void
+// One palette for the whole batch from a sample of every image, so all frames of an animation index the same colours
+auto build_shared_palette(std::vector<image*>& in_vector, thread_pool& in_pool, progress& in_bar, memory_budget& in_budget, const quantizer& in_quantizer) -> palette
 {
+	// Enough pixels per image for the median cut to see every region of colour space that matters
+	constexpr size_t max_samples = size_t{1} << 20;
+
 	std::mutex progress_mutex;
+	std::vector<std::vector<color_count>> histograms(in_vector.size());
 
-	auto compress_image = [&progress_mutex](image* ptr_img, progress& in_bar)
+	auto sample_image = [&](size_t in_idx)
 	{
-		ptr_img->perform_compresion();
+		auto* ptr_img = in_vector[in_idx];
+
+		const bool was_loaded = ptr_img->is_loaded();
+		const auto held_size  = was_loaded ? 0 : ptr_img->get_load_size();
+
+		try
+		{
+			if (!was_loaded)
+			{
+				ptr_img->load();
+			}
+
+			const auto pixel_count = static_cast<size_t>(ptr_img->get_rect().get_width()) * static_cast<size_t>(ptr_img->get_rect().get_height());
+			histograms[in_idx]	   = quantizer::build_histogram(ptr_img->get_data(), pixel_count, ptr_img->get_channels(), (pixel_count + max_samples - 1) / max_samples);
+
+			if (!was_loaded)
+			{
+				ptr_img->release();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			spdlog::error("Failed to sample image: {}", e.what());
+		}
+
+		in_budget.release(held_size);
+
 		std::lock_guard<std::mutex> lock(progress_mutex);
 		in_bar.print_progress();
 	};
@@ -189,35 +501,186 @@ auto compress_images(std::vector<image*>& in_vector, progress& in_bar) -> void
 	in_bar.set_progress(0);
 	in_bar.set_total(in_vector.size());
 
-	const size_t size_vector = in_vector.size();
+	spdlog::info("Building shared palette...");
+
+	std::vector<thread_pool::task> tasks;
+	for (size_t idx = 0; idx < in_vector.size(); ++idx)
+	{
+		auto* ptr_img = in_vector[idx];
+		tasks.push_back({ptr_img->get_decoded_size(), [&sample_image, idx]() { sample_image(idx); }, ptr_img->is_loaded() ? 0 : ptr_img->get_load_size()});
+	}
 
-	// Get number of max threads
-	const auto max_threads = std::thread::hardware_concurrency();
-	const auto num_threads = std::min(max_threads, static_cast<uint32_t>(size_vector));
+	in_pool.run(std::move(tasks), &in_budget);
 
-	std::vector<std::future<void>> futures;
-	const size_t chunk_size = size_vector / num_threads;
+	auto merged				= quantizer::merge_histograms(histograms);
+	const auto unique_count = merged.size();
+
+	auto colors = in_quantizer.build_palette(std::move(merged));
+	spdlog::info("Shared palette of {} colours from {} unique sampled colours", colors.size(), unique_count);
+
+	return colors;
+}
+
+// Without a writer the PNGs go through pngquant in batches of files, with one every image is quantized in process
+auto compress_images(std::vector<image*>& in_vector, thread_pool& in_pool, progress& in_bar, memory_budget& in_budget, png_writer& in_writer, bool in_internal,
+					 const pngquant_runner& in_pngquant) -> void
+{
+	std::mutex progress_mutex;
+	std::array<std::atomic<size_t>, 3> status_counts{};
+
+	auto report = [&progress_mutex, &in_bar](size_t in_done)
+	{
+		std::lock_guard<std::mutex> lock(progress_mutex);
+		for (size_t idx = 0; idx < in_done; ++idx)
+		{
+			in_bar.print_progress();
+		}
+	};
+
+	// Decoded pixels and encoder state of one in-process quantize, admitted before the task is queued
+	auto get_held_size = [&in_writer](const image* ptr_img) -> size_t
+	{
+		const auto pixel_count = static_cast<size_t>(ptr_img->get_rect().get_width()) * static_cast<size_t>(ptr_img->get_rect().get_height());
+		return ptr_img->is_loaded() ? 0 : ptr_img->get_load_size() + in_writer.get_working_size(pixel_count, ptr_img->get_channels());
+	};
+
+	// The pre-check decodes one file of the batch at a time, so the largest of them is what the batch holds
+	auto get_batch_held_size = [](const std::vector<image*>& in_batch) -> size_t
+	{
+		size_t held_size = 0;
+		for (const auto* ptr_img : in_batch)
+		{
+			held_size = std::max(held_size, ptr_img->is_loaded() || ptr_img->is_paletted() ? 0 : ptr_img->get_load_size());
+		}
+
+		return held_size;
+	};
+
+	auto compress_image = [&report, &in_budget, &in_writer, &get_held_size, in_internal](image* ptr_img)
+	{
+		if (!in_internal)
+		{
+			try
+			{
+				ptr_img->perform_compresion();
+			}
+			catch (const std::exception& e)
+			{
+				spdlog::error("Failed to compress image: {}", e.what());
+			}
+		}
+		else
+		{
+			const auto held_size = get_held_size(ptr_img);
+
+			try
+			{
+				ptr_img->quantize(in_writer);
+			}
+			catch (const std::exception& e)
+			{
+				spdlog::error("Failed to quantize image: {}", e.what());
+			}
+
+			in_budget.release(held_size);
+		}
+
+		report(1);
+	};
+
+	// Only the files the pre-check lets through reach pngquant, one failed file is reported on its own and never takes the rest of its batch down
+	auto compress_batch = [&report, &status_counts, &in_budget, &in_writer, &in_pngquant, &get_batch_held_size](const std::vector<image*>& in_batch)
+	{
+		const auto held_size = get_batch_held_size(in_batch);
+
+		std::vector<std::string> file_paths;
+		size_t pixel_count = 0;
+
+		for (auto* ptr_img : in_batch)
+		{
+			try
+			{
+				if (ptr_img->precheck(in_writer))
+				{
+					file_paths.push_back(ptr_img->get_file_path());
+					pixel_count += static_cast<size_t>(ptr_img->get_rect().get_width()) * static_cast<size_t>(ptr_img->get_rect().get_height());
+				}
+			}
+			catch (const std::exception& e)
+			{
+				spdlog::error("Failed to pre-check image: {}", e.what());
+			}
+		}
+
+		// pngquant works on the files in its own process, nothing of the batch is held past the pre-check
+		in_budget.release(held_size);
+
+		const auto start   = std::chrono::steady_clock::now();
+		const auto results = in_pngquant.compress_files(file_paths);
+		in_writer.record_quantize_time(pixel_count, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		for (const auto& result : results)
+		{
+			++status_counts[static_cast<size_t>(result.status)];
+
+			if (result.status == compress_status::failed)
+			{
+				spdlog::error("Failed to compress {}: {}", result.file_path, result.message);
+			}
+		}
+
+		report(in_batch.size());
+	};
+
+	in_bar.set_progress(0);
+	in_bar.set_total(in_vector.size());
 
 	spdlog::info("Compressing images...");
 
-	for (size_t i = 0; i < num_threads; ++i)
+	const auto use_pngquant = [in_internal](const image* ptr_img) { return !in_internal && ptr_img->get_format() == image_format::png; };
+
+	// Batches stay small enough to keep every worker busy, a process per file only costs its start up
+	const auto num_pngs	  = static_cast<size_t>(std::count_if(in_vector.begin(), in_vector.end(), use_pngquant));
+	const auto batch_size = std::clamp<size_t>((num_pngs + in_pool.get_num_threads() - 1) / in_pool.get_num_threads(), 1, in_pngquant.get_batch_size());
+
+	// The compressor works on the written files, so their size is the best guess of the work
+	std::vector<thread_pool::task> tasks;
+	std::vector<std::vector<image*>> batches;
+	std::vector<size_t> batch_costs;
+
+	for (auto* ptr_img : in_vector)
 	{
-		const size_t start = i * chunk_size;
-		const size_t end   = (i + 1 == num_threads) ? size_vector : (i + 1) * chunk_size;
+		std::error_code error;
+		const auto size		 = std::filesystem::file_size(ptr_img->get_file_path(), error);
+		const auto file_size = error ? 0 : static_cast<size_t>(size);
 
-		futures.push_back(std::async(std::launch::async,
-									 [&in_vector, start, end, &in_bar, &compress_image]()
-									 {
-										 for (size_t j = start; j < end; ++j)
-										 {
-											 compress_image(in_vector[j], in_bar);
-										 }
-									 }));
+		if (use_pngquant(ptr_img))
+		{
+			if (batches.empty() || batches.back().size() == batch_size)
+			{
+				batches.emplace_back();
+				batch_costs.push_back(0);
+			}
+
+			batches.back().push_back(ptr_img);
+			batch_costs.back() += file_size;
+			continue;
+		}
+
+		tasks.push_back({file_size, [&compress_image, ptr_img]() { compress_image(ptr_img); }, in_internal ? get_held_size(ptr_img) : 0});
 	}
 
-	for (auto& future : futures)
+	for (size_t idx = 0; idx < batches.size(); ++idx)
 	{
-		future.get();
+		tasks.push_back({batch_costs[idx], [&compress_batch, &batches, idx]() { compress_batch(batches[idx]); }, get_batch_held_size(batches[idx])});
+	}
+
+	in_pool.run(std::move(tasks), &in_budget);
+
+	if (!batches.empty())
+	{
+		spdlog::info("pngquant compressed {} images in {} batches, skipped {} that would grow, {} failed", status_counts[static_cast<size_t>(compress_status::compressed)].load(),
+					 batches.size(), status_counts[static_cast<size_t>(compress_status::skipped)].load(), status_counts[static_cast<size_t>(compress_status::failed)].load());
 	}
 }
 
@@ -226,15 +689,43 @@ auto main(int32_t argc, char* argv[]) -> int32_t
 	std::filesystem::path path_dir;
 
 	std::string check_pattern;
+	std::string shared_palette_path;
 
 	bool perform_trim		= false;
 	bool perform_compresion = false;
 	bool perform_dry_run	= false;
 	bool apply_parity		= false;
+	bool parity_mcu			= false;
+	bool jpeg_lossless		= false;
+	bool exclusion_scan		= false;
+	bool streaming			= false;
+	bool optimize			= false;
+	bool dither				= false;
+	bool skip_crc			= false;
 
 	uint8_t log_level = spdlog::level::err;
 	uint8_t algorithm = 1;
 
+	size_t min_island	= 0;
+	size_t memory_limit = 0;
+	size_t max_bytes	= 0;
+	size_t total_bytes	= 0;
+
+	int32_t jpeg_quality = 90;
+	int32_t webp_quality = 90;
+
+	png_encoder encoder = png_encoder::zlib;
+	png_effort effort	= png_effort::balanced;
+
+	quantizer_backend quantizer_choice = quantizer_backend::internal;
+	std::vector<image_decoder> decoders;
+
+	const std::map<std::string, png_encoder> encoder_names{{"stb", png_encoder::stb}, {"zlib", png_encoder::zlib}};
+	const std::map<std::string, png_effort> effort_names{{"fast", png_effort::fast}, {"balanced", png_effort::balanced}, {"small", png_effort::small}};
+	const std::map<std::string, quantizer_backend> quantizer_names{{"internal", quantizer_backend::internal}, {"pngquant", quantizer_backend::pngquant}};
+	const std::map<std::string, image_decoder> decoder_names{
+		{"stb", image_decoder::stb}, {"png", image_decoder::png_rows}, {"libjpeg", image_decoder::libjpeg}, {"qoi", image_decoder::qoi}, {"webp", image_decoder::webp}};
+
 	// Bulk trim images based on their alpha channel
 	CLI::App app{std::format("Image trimmer\n\tVersion: {}\n", VERSION)};
 	argv = app.ensure_utf8(argv);
@@ -246,9 +737,33 @@ auto main(int32_t argc, char* argv[]) -> int32_t
 	app.add_flag("-z,--compress", perform_compresion, "Flag:Compress the images");
 	app.add_flag("-d,--dry-run", perform_dry_run, "Flag: Dry run, do not modify the images");
 	app.add_flag("-e,--parity", apply_parity, "Flag: Adds to new image offsets to make it even.");
+	app.add_flag("--parity-mcu", parity_mcu, "Flag: Snap the new image offsets down to the JPEG iMCU grid instead of to even, implies --parity");
+	app.add_option("-m,--memory-limit", memory_limit, "Upper bound for decoded pixels held at once, e.g. 4GB, 0 for no limit")->transform(CLI::AsSizeValue(false));
+	app.add_flag("-s,--streaming", streaming, "Flag: Free the pixels after the scan and decode again for the trim, picked automatically when the batch does not fit in memory");
+	app.add_flag("-x,--exclusion-scan", exclusion_scan, "Flag: Only scan the area outside the union of the previous images");
 
 	app.add_option("-v,--verbose", log_level, "Set the log level, 0 for trace, 1 for debug, 2 for info, 3 for warn, 4 for error, 5 for critical, 6 for off");
-	app.add_option("-a,--algorithm", algorithm, "Algorithm to use for bounding box calculation, 0 for flood fill, 1 for std algo");
+	app.add_option("-a,--algorithm", algorithm, "Algorithm to use for bounding box calculation, 0 for flood fill, 1 for std algo, 2 for edge inward, 3 for connected components");
+	app.add_option("--min-island", min_island, "Ignore connected components smaller than this many pixels, implies algorithm 3");
+	app.add_option("--png-encoder", encoder, "PNG encoder for the trimmed images, stb or zlib")->transform(CLI::CheckedTransformer(encoder_names, CLI::ignore_case));
+	app.add_option("--png-effort", effort, "PNG encoder effort, fast, balanced or small")->transform(CLI::CheckedTransformer(effort_names, CLI::ignore_case));
+	app.add_option("--jpeg-quality", jpeg_quality, "Quality of the trimmed JPEGs, 1 to 100")->check(CLI::Range(1, 100));
+	app.add_option("--webp-quality", webp_quality, "Quality of the trimmed lossy WebPs, 1 to 100, lossless ones stay lossless")->check(CLI::Range(1, 100));
+	app.add_option("--decoder", decoders, "Decoders to prefer, each takes over the formats it reads: stb, png, libjpeg, qoi or webp")
+		->transform(CLI::CheckedTransformer(decoder_names, CLI::ignore_case));
+	app.add_flag("--skip-crc", skip_crc, "Flag: Skip the CRC checks of the PNG chunks");
+	app.add_flag("--jpeg-lossless", jpeg_lossless, "Flag: Crop the JPEGs in the DCT domain without re-encoding them, implies --parity-mcu");
+	app.add_flag("--optimize", optimize, "Flag: Try every PNG filter and deflate strategy on the trimmed pixels and keep the smallest file");
+	app.add_option("--quantizer", quantizer_choice, "Palette quantizer for --compress, internal or pngquant")->transform(CLI::CheckedTransformer(quantizer_names, CLI::ignore_case));
+	app.add_flag("--dither", dither, "Flag: Floyd-Steinberg dithering in the internal quantizer");
+	auto* shared_palette_option = app.add_option("--shared-palette", shared_palette_path,
+												 "Map every image to one palette built from the whole batch and save that palette as a PNG at this path, implies --compress");
+	app.add_option("--max-bytes", max_bytes, "Byte budget of every file, e.g. 200kb, files over it get the most palette colours that fit, implies --compress")
+		->transform(CLI::AsSizeValue(false))
+		->excludes(shared_palette_option);
+	app.add_option("--total-bytes", total_bytes, "Byte budget of the whole batch, split between the files by their pixel area, implies --compress")
+		->transform(CLI::AsSizeValue(false))
+		->excludes(shared_palette_option);
 
 	CLI11_PARSE(app, argc, argv);
 
@@ -269,6 +784,61 @@ auto main(int32_t argc, char* argv[]) -> int32_t
 	spdlog::trace("Compress: {}", perform_compresion);
 	spdlog::trace("Log level: {}", log_level);
 	spdlog::trace("Algorithm: {}", algorithm);
+	spdlog::trace("Exclusion scan: {}", exclusion_scan);
+	spdlog::trace("Min island: {}", min_island);
+	spdlog::trace("Streaming: {}", streaming);
+	spdlog::trace("Memory limit: {}", memory_limit);
+	spdlog::trace("PNG encoder: {}", static_cast<uint8_t>(encoder));
+	spdlog::trace("PNG effort: {}", static_cast<uint8_t>(effort));
+	spdlog::trace("JPEG quality: {}", jpeg_quality);
+	spdlog::trace("WebP quality: {}", webp_quality);
+	spdlog::trace("Decoders: {}", decoders.size());
+	spdlog::trace("Skip CRC: {}", skip_crc);
+	spdlog::trace("Parity MCU: {}", parity_mcu);
+	spdlog::trace("JPEG lossless: {}", jpeg_lossless);
+	spdlog::trace("Optimize: {}", optimize);
+	spdlog::trace("Quantizer: {}", static_cast<uint8_t>(quantizer_choice));
+	spdlog::trace("Dither: {}", dither);
+	spdlog::trace("Shared palette: {}", shared_palette_path);
+	spdlog::trace("Max bytes: {}", max_bytes);
+	spdlog::trace("Total bytes: {}", total_bytes);
+
+	if (min_island > 0 && algorithm != 3)
+	{
+		spdlog::info("Min island set, using connected components");
+		algorithm = 3;
+	}
+
+	if (!shared_palette_path.empty() && (!perform_compresion || quantizer_choice != quantizer_backend::internal))
+	{
+		spdlog::info("Shared palette set, compressing with the internal quantizer");
+		perform_compresion = true;
+		quantizer_choice   = quantizer_backend::internal;
+	}
+
+	if ((max_bytes > 0 || total_bytes > 0) && (!perform_compresion || quantizer_choice != quantizer_backend::internal))
+	{
+		spdlog::info("Byte budget set, compressing with the internal quantizer");
+		perform_compresion = true;
+		quantizer_choice   = quantizer_backend::internal;
+	}
+
+	if (jpeg_lossless && !parity_mcu)
+	{
+		spdlog::info("JPEG lossless set, aligning the offsets to the iMCU grid");
+		parity_mcu = true;
+	}
+
+	if (parity_mcu)
+	{
+		apply_parity = true;
+	}
+
+	if (optimize && encoder != png_encoder::zlib)
+	{
+		spdlog::info("Optimize set, using the zlib encoder");
+		encoder = png_encoder::zlib;
+	}
 
 	if (!std::filesystem::exists(path_dir))
 	{
@@ -280,29 +850,199 @@ auto main(int32_t argc, char* argv[]) -> int32_t
 	std::vector<std::string> image_file_paths = gather_file_paths(path_dir, check_pattern);
 	const double_t prev_size				  = get_file_size(image_file_paths);
 
-	populate_images(images, image_file_paths);
+	png_reader::set_verify_crc(!skip_crc);
+	webp_codec::set_quality(webp_quality);
+
+	decoder_registry registry;
+	for (const auto decoder : decoders)
+	{
+		registry.prefer(decoder);
+	}
+
+	populate_images(images, image_file_paths, registry);
 
 	spdlog::info("Found {} images", images.size());
 
 	progress progress_bar;
-	progress_bar.set_total(images.size());
 	progress_bar.set_is_incremental(true);
 	progress_bar.set_is_verbose(log_level <= spdlog::level::info);
+
+	// Keeping every decoded image resident only pays off while the whole batch fits in memory, a dry run only ever holds the alpha planes
+	size_t decoded_size = 0;
+	size_t max_load_size = 0;
+	for (const auto* img : images)
+	{
+		const bool resident = perform_trim && !img->prefers_crop_decode();
+
+		decoded_size += resident ? img->get_decoded_size() : img->get_plane_size();
+		max_load_size = std::max(max_load_size, resident ? img->get_load_size() : img->get_plane_load_size());
+	}
+
+	memory_budget budget;
+	budget.set_limit(memory_limit);
+
+	// Every stage below shares the same workers
+	thread_pool pool(std::thread::hardware_concurrency());
+
+	// Resident images only free their budget in the trim, so the whole batch plus one decode in flight must fit the limit
+	const auto available_memory = get_available_memory();
+	streaming					= streaming || decoded_size > available_memory / 2 || (memory_limit > 0 && decoded_size + max_load_size > memory_limit);
+
+	spdlog::info("Decoded size: {:.2f} MB, available memory: {:.2f} MB, using {} mode", static_cast<double_t>(decoded_size) / 1e6,
+				 static_cast<double_t>(available_memory) / 1e6, streaming ? "streaming" : "resident");
+
+	if (perform_trim || perform_dry_run)
+	{
+		// Scan each image as soon as it is decoded, the exclusion scan needs the running union so it waits unless the pixels are freed right away.
+		// Fewer images than threads are split into row tiles, calculate_new_rect tiles the resident ones and the freed ones are tiled here.
+		const auto row_tiles = get_row_tiles(images.size(), pool.get_num_threads(), algorithm);
+
+		// Freed images grow the union of those decoded before them, flood fill and the island filter still scan fully
+		const bool decode_exclusion = streaming && exclusion_scan && (algorithm == 1 || algorithm == 2);
+
+		std::mutex union_mutex;
+		rect running_union;
+
+		std::function<void(image*)> on_loaded;
+		if (streaming && (row_tiles > 1 || decode_exclusion))
+		{
+			on_loaded = [&pool, &union_mutex, &running_union, row_tiles, decode_exclusion](image* ptr_img)
+			{
+				rect seed;
+				if (decode_exclusion)
+				{
+					std::lock_guard<std::mutex> lock(union_mutex);
+					seed = running_union;
+				}
+
+				// Pixels inside the seed are never read, the result holds it so the union of the results stays the same
+				const auto found = row_tiles > 1 ? scan_row_tiles(ptr_img, pool, row_tiles, seed) : ptr_img->grow_boundings(seed);
+				ptr_img->set_image_boundings(found);
+
+				if (decode_exclusion)
+				{
+					std::lock_guard<std::mutex> lock(union_mutex);
+					running_union = running_union.get_union(found);
+				}
+			};
+		}
+		else if (streaming || (!exclusion_scan && row_tiles == 1))
+		{
+			on_loaded = [algorithm, min_island](image* ptr_img) { ptr_img->get_image_boundings(algorithm, min_island); };
+		}
+
+		// The colour channels are only needed when the trim reuses the resident pixels
+		const bool alpha_only = streaming || !perform_trim;
+
+		decode_images(images, pool, progress_bar, budget, on_loaded, streaming, alpha_only);
+	}
+
 	rect new_rect;
 
 	if (perform_trim || perform_dry_run)
 	{
-		new_rect = calculate_new_rect(images, progress_bar, algorithm, apply_parity);
+		const auto mcu = parity_mcu ? get_mcu_alignment(images) : mcu_size{1, 1};
+		if (parity_mcu)
+		{
+			spdlog::info("Aligning to the {}x{} iMCU grid", mcu.width, mcu.height);
+		}
+
+		new_rect = calculate_new_rect(images, pool, progress_bar, algorithm, min_island, apply_parity, mcu, exclusion_scan);
+	}
+
+	png_writer writer(encoder, effort, &pool);
+	writer.set_optimize(optimize);
+
+	jpeg_writer jpeg_output(jpeg_quality);
+	jpeg_output.set_progressive(perform_compresion);
+	jpeg_output.set_lossless(jpeg_lossless);
+
+	// The trimmed pixels are already in memory, quantizing them there saves decoding every file again
+	const quantizer palette_quantizer(256, dither);
+	const pngquant_runner pngquant;
+	const bool internal_quantizer = perform_compresion && quantizer_choice == quantizer_backend::internal;
+
+	if (internal_quantizer)
+	{
+		writer.set_quantizer(&palette_quantizer);
+	}
+	else if (perform_compresion)
+	{
+		// pngquant is fed through a pipe, one that exits before reading all of stdin would otherwise take the whole tool down with SIGPIPE
+		std::signal(SIGPIPE, SIG_IGN);
+		writer.set_pngquant(&pngquant);
+	}
+
+	writer.set_max_bytes(max_bytes);
+	if (total_bytes > 0)
+	{
+		writer.set_file_budgets(split_byte_budget(images, total_bytes, max_bytes, perform_trim));
+	}
+
+	palette shared_colors;
+	if (!shared_palette_path.empty())
+	{
+		shared_colors = build_shared_palette(images, pool, progress_bar, budget, palette_quantizer);
+
+		writer.set_shared_palette(&shared_colors);
+		writer.write_palette(shared_palette_path, shared_colors);
 	}
 
 	if (perform_trim)
 	{
-		trim_images(images, progress_bar, new_rect);
+		// Wall time of the whole pass, encodes overlap and nest on the pool so per-file timings would not add up
+		const auto trim_start = std::chrono::steady_clock::now();
+		trim_images(images, pool, progress_bar, new_rect, budget, writer, jpeg_output);
+		const std::chrono::duration<double_t> trim_time = std::chrono::steady_clock::now() - trim_start;
+
+		const auto raw_size = static_cast<double_t>(writer.get_raw_bytes()) / 1e6;
+		if (writer.get_raw_bytes() > 0)
+		{
+			spdlog::info("Encoded {:.2f} MB with {} in {:.2f}s ({:.1f} MB/s), {:.2f} MB written", raw_size, writer.get_encoder_name(), trim_time.count(),
+						 trim_time.count() > 0 ? raw_size / trim_time.count() : 0.0, static_cast<double_t>(writer.get_encoded_bytes()) / 1e6);
+		}
+
+		if (jpeg_output.get_files() > 0)
+		{
+			spdlog::info("Encoded {} JPEGs of {:.2f} MB at quality {}, {:.2f} MB written", jpeg_output.get_files(), static_cast<double_t>(jpeg_output.get_raw_bytes()) / 1e6,
+						 jpeg_output.get_quality(), static_cast<double_t>(jpeg_output.get_encoded_bytes()) / 1e6);
+		}
+
+		if (jpeg_output.get_lossless_files() > 0)
+		{
+			spdlog::info("Cropped {} JPEGs losslessly, {:.2f} MB written", jpeg_output.get_lossless_files(), static_cast<double_t>(jpeg_output.get_lossless_bytes()) / 1e6);
+		}
 	}
 
 	if (perform_compresion)
 	{
-		compress_images(images, progress_bar);
+		if (!perform_trim)
+		{
+			compress_images(images, pool, progress_bar, budget, writer, internal_quantizer, pngquant);
+		}
+
+		// The saving is extrapolated from the images that were quantized, without any there is nothing to go on
+		if (writer.get_paletted_files() > 0 || writer.get_hopeless_files() > 0)
+		{
+			spdlog::info("Pre-check skipped {} already paletted images and {} unlikely to shrink{}", writer.get_paletted_files(), writer.get_hopeless_files(),
+						 writer.get_saved_seconds() > 0 ? std::format(", about {:.2f}s of quantization saved", writer.get_saved_seconds()) : "");
+		}
+
+		if (perform_trim || internal_quantizer)
+		{
+			spdlog::info("Quantized {} images, kept {} as truecolour where the palette was not smaller", writer.get_quantized_files(), writer.get_truecolor_files());
+		}
+
+		if (writer.get_searched_files() > 0)
+		{
+			spdlog::info("Byte budget searched {} images with {} candidate encodes, {} still over budget", writer.get_searched_files(), writer.get_search_encodes(),
+						 writer.get_over_budget_files());
+		}
+
+		if (writer.get_failed_files() > 0)
+		{
+			spdlog::error("pngquant failed on {} images, they were written without it", writer.get_failed_files());
+		}
 
 		const double_t new_size = get_file_size(image_file_paths);
 		const double_t ratio	= (prev_size - new_size) / prev_size;
@@ -310,6 +1050,22 @@ auto main(int32_t argc, char* argv[]) -> int32_t
 		spdlog::info("Compression ratio: {:.2f}% ({:.0f} -> {:.0f})", ratio * 100, prev_size, new_size);
 	}
 
+	// Decode time is summed over the workers, so the rate is what one thread gets out of each decoder
+	for (const auto decoder : {image_decoder::stb, image_decoder::png_rows, image_decoder::libjpeg, image_decoder::qoi, image_decoder::webp})
+	{
+		const auto stats = decoder_registry::get_decode_stats(decoder);
+		if (stats.files > 0)
+		{
+			spdlog::info("Decoded {:.2f} MB in {} passes with {} in {:.2f}s ({:.1f} MB/s per thread)", static_cast<double_t>(stats.bytes) / 1e6, stats.files,
+						 decoder_registry::get_decoder_name(decoder), stats.seconds, stats.seconds > 0 ? static_cast<double_t>(stats.bytes) / 1e6 / stats.seconds : 0.0);
+		}
+	}
+
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+
+	spdlog::info("Peak RSS: {:.2f} MB, peak projected pixels: {:.2f} MB", static_cast<double_t>(usage.ru_maxrss) / 1e3, static_cast<double_t>(budget.get_peak()) / 1e6);
+
 	spdlog::info("Cleaning up...");
 	std::for_each(images.begin(), images.end(), [](auto* img) { delete img; });
 
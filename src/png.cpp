@@ -0,0 +1,726 @@
+#include "png.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// The build defines it when it finds both the header and the library, the header check only covers builds that do not
+#ifndef TRIMMER_HAS_LIBDEFLATE
+#if __has_include(<libdeflate.h>)
+#define TRIMMER_HAS_LIBDEFLATE 1
+#else
+#define TRIMMER_HAS_LIBDEFLATE 0
+#endif
+#endif
+
+#if TRIMMER_HAS_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	constexpr std::array<uint8_t, 8> png_signature = {137, 80, 78, 71, 13, 10, 26, 10};
+	constexpr size_t input_window				   = size_t{64} * 1024;
+	constexpr size_t ihdr_size					   = 13;
+
+	std::atomic<bool> verify_crc{true};
+
+	auto read_u32(const uint8_t* ptr_bytes) -> uint32_t
+	{
+		return (static_cast<uint32_t>(ptr_bytes[0]) << 24) | (static_cast<uint32_t>(ptr_bytes[1]) << 16) | (static_cast<uint32_t>(ptr_bytes[2]) << 8)
+			 | static_cast<uint32_t>(ptr_bytes[3]);
+	}
+
+	auto paeth(int32_t in_left, int32_t in_up, int32_t in_up_left) -> uint8_t
+	{
+		const int32_t estimate	 = in_left + in_up - in_up_left;
+		const int32_t dist_left	 = std::abs(estimate - in_left);
+		const int32_t dist_up	 = std::abs(estimate - in_up);
+		const int32_t dist_upper = std::abs(estimate - in_up_left);
+
+		if (dist_left <= dist_up && dist_left <= dist_upper)
+		{
+			return static_cast<uint8_t>(in_left);
+		}
+
+		return static_cast<uint8_t>(dist_up <= dist_upper ? in_up : in_up_left);
+	}
+
+	// libdeflate folds the CRC with PCLMUL where the CPU has it, zlib 1.2 has only a table driven one
+	auto update_crc(uint32_t in_crc, const uint8_t* ptr_data, size_t in_size) -> uint32_t
+	{
+#if TRIMMER_HAS_LIBDEFLATE
+		return libdeflate_crc32(in_crc, ptr_data, in_size);
+#else
+		return static_cast<uint32_t>(crc32(in_crc, ptr_data, static_cast<uInt>(in_size)));
+#endif
+	}
+
+	// Width, height and channels of an IHDR the reader supports, false for anything stb has to handle
+	auto parse_header(const uint8_t* ptr_header, int32_t& out_width, int32_t& out_height, size_t& out_channels) -> bool
+	{
+		out_width  = static_cast<int32_t>(read_u32(ptr_header));
+		out_height = static_cast<int32_t>(read_u32(ptr_header + 4));
+
+		const auto bit_depth  = ptr_header[8];
+		const auto color_type = ptr_header[9];
+		const auto interlace  = ptr_header[12];
+
+		switch (color_type)
+		{
+		case 0:
+			out_channels = 1;
+			break;
+		case 2:
+			out_channels = 3;
+			break;
+		case 4:
+			out_channels = 2;
+			break;
+		case 6:
+			out_channels = 4;
+			break;
+		default:
+			return false;
+		}
+
+		return bit_depth == 8 && interlace == 0 && out_width > 0 && out_height > 0;
+	}
+
+#if defined(__SSE2__)
+	// Sub, Avg and Paeth depend on the pixel to the left, so the SSE2 versions work one pixel at a time with every channel in its own lane
+
+	template <size_t bpp> auto load_pixel(const uint8_t* ptr_pixel) -> __m128i
+	{
+		int32_t value = 0;
+		std::memcpy(&value, ptr_pixel, bpp);
+		return _mm_cvtsi32_si128(value);
+	}
+
+	template <size_t bpp> auto store_pixel(uint8_t* ptr_pixel, __m128i in_value) -> void
+	{
+		const int32_t value = _mm_cvtsi128_si32(in_value);
+		std::memcpy(ptr_pixel, &value, bpp);
+	}
+
+	template <size_t bpp> auto unfilter_sub(uint8_t* ptr_row, size_t in_stride) -> void
+	{
+		__m128i left = _mm_setzero_si128();
+		for (size_t idx = 0; idx < in_stride; idx += bpp)
+		{
+			left = _mm_add_epi8(left, load_pixel<bpp>(ptr_row + idx));
+			store_pixel<bpp>(ptr_row + idx, left);
+		}
+	}
+
+	template <size_t bpp> auto unfilter_avg(uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_stride) -> void
+	{
+		const __m128i ones = _mm_set1_epi8(1);
+		__m128i left	   = _mm_setzero_si128();
+
+		for (size_t idx = 0; idx < in_stride; idx += bpp)
+		{
+			const __m128i up = load_pixel<bpp>(ptr_prev + idx);
+
+			// _mm_avg_epu8 rounds up and PNG truncates, the low bit of left ^ up says where the two differ
+			const __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), ones));
+
+			left = _mm_add_epi8(load_pixel<bpp>(ptr_row + idx), average);
+			store_pixel<bpp>(ptr_row + idx, left);
+		}
+	}
+
+	auto select(__m128i in_mask, __m128i in_true, __m128i in_false) -> __m128i { return _mm_or_si128(_mm_and_si128(in_mask, in_true), _mm_andnot_si128(in_mask, in_false)); }
+
+	auto abs_epi16(__m128i in_value) -> __m128i { return _mm_max_epi16(in_value, _mm_sub_epi16(_mm_setzero_si128(), in_value)); }
+
+	// The predictor needs 9 bits, the channels are widened to 16-bit lanes and packed again for the store
+	template <size_t bpp> auto unfilter_paeth(uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_stride) -> void
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i left	   = zero;
+		__m128i up_left	   = zero;
+
+		for (size_t idx = 0; idx < in_stride; idx += bpp)
+		{
+			const __m128i up = _mm_unpacklo_epi8(load_pixel<bpp>(ptr_prev + idx), zero);
+
+			// With p = left + up - up_left: p - left = up - up_left, p - up = left - up_left and p - up_left is their sum
+			const __m128i diff_left	   = _mm_sub_epi16(up, up_left);
+			const __m128i diff_up	   = _mm_sub_epi16(left, up_left);
+			const __m128i dist_left	   = abs_epi16(diff_left);
+			const __m128i dist_up	   = abs_epi16(diff_up);
+			const __m128i dist_up_left = abs_epi16(_mm_add_epi16(diff_left, diff_up));
+			const __m128i smallest	   = _mm_min_epi16(dist_up_left, _mm_min_epi16(dist_left, dist_up));
+
+			// Ties go to left, then up
+			const __m128i nearest = select(_mm_cmpeq_epi16(smallest, dist_left), left, select(_mm_cmpeq_epi16(smallest, dist_up), up, up_left));
+
+			// A byte add keeps the high byte of every lane at zero, so the sum wraps like the scalar one
+			left = _mm_add_epi8(_mm_unpacklo_epi8(load_pixel<bpp>(ptr_row + idx), zero), nearest);
+			store_pixel<bpp>(ptr_row + idx, _mm_packus_epi16(left, left));
+
+			up_left = up;
+		}
+	}
+#endif
+
+	auto is_zero(const uint8_t* ptr_data, size_t in_size) -> bool
+	{
+		size_t idx = 0;
+
+		// OR of 64 bytes at a time vectorises, rows with content bail out on their first non-zero block
+		for (; idx + 64 <= in_size; idx += 64)
+		{
+			std::array<uint64_t, 8> words{};
+			std::memcpy(words.data(), ptr_data + idx, 64);
+
+			uint64_t merged = 0;
+			for (const auto word : words)
+			{
+				merged |= word;
+			}
+
+			if (merged != 0)
+			{
+				return false;
+			}
+		}
+
+		for (; idx < in_size; ++idx)
+		{
+			if (ptr_data[idx] != 0)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// An all-zero payload only adds zeros to its predictor: None and Sub then give a zero row on their own, Up, Avg and Paeth when the row above is zero too
+	auto is_clear_row(uint8_t in_filter, const uint8_t* ptr_payload, size_t in_stride, bool in_prev_clear) -> bool
+	{
+		return in_filter <= 4 && (in_filter <= 1 || in_prev_clear) && is_zero(ptr_payload, in_stride);
+	}
+
+	// Reconstructs one row in place, false for an unknown filter type
+	auto unfilter_row(uint8_t in_filter, uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_bpp, size_t in_stride) -> bool
+	{
+		switch (in_filter)
+		{
+		case 0:
+			return true;
+		case 1:
+#if defined(__SSE2__)
+			if (in_bpp == 4)
+			{
+				unfilter_sub<4>(ptr_row, in_stride);
+				return true;
+			}
+			if (in_bpp == 3)
+			{
+				unfilter_sub<3>(ptr_row, in_stride);
+				return true;
+			}
+#endif
+			for (size_t idx = in_bpp; idx < in_stride; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + ptr_row[idx - in_bpp]);
+			}
+			return true;
+		case 2:
+			// Independent bytes, the compiler vectorises this one on its own
+			for (size_t idx = 0; idx < in_stride; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + ptr_prev[idx]);
+			}
+			return true;
+		case 3:
+#if defined(__SSE2__)
+			if (in_bpp == 4)
+			{
+				unfilter_avg<4>(ptr_row, ptr_prev, in_stride);
+				return true;
+			}
+			if (in_bpp == 3)
+			{
+				unfilter_avg<3>(ptr_row, ptr_prev, in_stride);
+				return true;
+			}
+#endif
+			for (size_t idx = 0; idx < in_bpp; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + (ptr_prev[idx] >> 1));
+			}
+			for (size_t idx = in_bpp; idx < in_stride; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + ((ptr_row[idx - in_bpp] + ptr_prev[idx]) >> 1));
+			}
+			return true;
+		case 4:
+#if defined(__SSE2__)
+			if (in_bpp == 4)
+			{
+				unfilter_paeth<4>(ptr_row, ptr_prev, in_stride);
+				return true;
+			}
+			if (in_bpp == 3)
+			{
+				unfilter_paeth<3>(ptr_row, ptr_prev, in_stride);
+				return true;
+			}
+#endif
+			for (size_t idx = 0; idx < in_bpp; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + ptr_prev[idx]);
+			}
+			for (size_t idx = in_bpp; idx < in_stride; ++idx)
+			{
+				ptr_row[idx] = static_cast<uint8_t>(ptr_row[idx] + paeth(ptr_row[idx - in_bpp], ptr_prev[idx], ptr_prev[idx - in_bpp]));
+			}
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Inflates all of in_compressed into out_raw, which must come out exactly full
+	auto inflate_all(const std::vector<uint8_t>& in_compressed, std::vector<uint8_t>& out_raw, const std::string& in_file_path) -> void
+	{
+#if TRIMMER_HAS_LIBDEFLATE
+		const std::unique_ptr<libdeflate_decompressor, decltype(&libdeflate_free_decompressor)> decompressor(libdeflate_alloc_decompressor(), &libdeflate_free_decompressor);
+		if (decompressor == nullptr)
+		{
+			throw std::runtime_error("Failed to initialise inflate: " + in_file_path);
+		}
+
+		size_t actual_size = 0;
+		const auto result  = libdeflate_zlib_decompress(decompressor.get(), in_compressed.data(), in_compressed.size(), out_raw.data(), out_raw.size(), &actual_size);
+
+		if (result != LIBDEFLATE_SUCCESS || actual_size != out_raw.size())
+		{
+			throw std::runtime_error("Corrupt PNG data: " + in_file_path);
+		}
+#else
+		z_stream stream{};
+		if (inflateInit(&stream) != Z_OK)
+		{
+			throw std::runtime_error("Failed to initialise inflate: " + in_file_path);
+		}
+
+		// avail_in and avail_out are 32-bit, huge images are fed in slices
+		constexpr size_t max_slice = std::numeric_limits<uInt>::max();
+
+		size_t consumed = 0;
+		size_t produced = 0;
+		int32_t result	= Z_OK;
+
+		while (result == Z_OK)
+		{
+			stream.next_in	 = const_cast<Bytef*>(in_compressed.data() + consumed);
+			stream.avail_in	 = static_cast<uInt>(std::min(in_compressed.size() - consumed, max_slice));
+			stream.next_out	 = out_raw.data() + produced;
+			stream.avail_out = static_cast<uInt>(std::min(out_raw.size() - produced, max_slice));
+
+			const auto in_before  = stream.avail_in;
+			const auto out_before = stream.avail_out;
+
+			result = inflate(&stream, Z_FINISH);
+
+			consumed += in_before - stream.avail_in;
+			produced += out_before - stream.avail_out;
+
+			// Z_BUF_ERROR with room left on both sides means the data ran out
+			if (result == Z_BUF_ERROR && produced < out_raw.size() && consumed < in_compressed.size())
+			{
+				result = Z_OK;
+			}
+		}
+
+		inflateEnd(&stream);
+
+		if (produced != out_raw.size() || (result != Z_STREAM_END && result != Z_BUF_ERROR))
+		{
+			throw std::runtime_error("Corrupt PNG data: " + in_file_path);
+		}
+#endif
+	}
+} // namespace
+
+png_reader::png_reader(const std::string& in_file_path) : m_file(in_file_path, std::ios::binary), m_file_path(in_file_path)
+{
+	if (!m_file || !read_header())
+	{
+		throw std::runtime_error("Unsupported PNG layout: " + m_file_path);
+	}
+}
+
+png_reader::~png_reader()
+{
+	if (m_stream_ready)
+	{
+		inflateEnd(&m_stream);
+	}
+}
+
+auto png_reader::can_read(const std::string& in_file_path) -> bool
+{
+	try
+	{
+		png_reader reader(in_file_path);
+		return true;
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+auto png_reader::is_paletted(const std::string& in_file_path) -> bool
+{
+	// Signature, IHDR length and type, width, height, bit depth and then the colour type
+	std::array<uint8_t, 26> header{};
+
+	std::ifstream file(in_file_path, std::ios::binary);
+	if (!file.read(reinterpret_cast<char*>(header.data()), header.size()))
+	{
+		return false;
+	}
+
+	return std::equal(png_signature.begin(), png_signature.end(), header.begin()) && std::memcmp(header.data() + 12, "IHDR", 4) == 0 && header[25] == 3;
+}
+
+auto png_reader::read_chunk_header(uint32_t& out_length, std::string& out_type) -> bool
+{
+	std::array<uint8_t, 8> header{};
+	if (!m_file.read(reinterpret_cast<char*>(header.data()), header.size()))
+	{
+		return false;
+	}
+
+	out_length = read_u32(header.data());
+	out_type.assign(reinterpret_cast<const char*>(header.data() + 4), 4);
+
+	return true;
+}
+
+auto png_reader::read_header() -> bool
+{
+	std::array<uint8_t, 8> signature{};
+	if (!m_file.read(reinterpret_cast<char*>(signature.data()), signature.size()) || signature != png_signature)
+	{
+		return false;
+	}
+
+	uint32_t length = 0;
+	std::string type;
+	bool has_header = false;
+
+	while (read_chunk_header(length, type))
+	{
+		if (type == "IHDR")
+		{
+			// Chunk type and data, the CRC covers both
+			std::array<uint8_t, 4 + ihdr_size> chunk{'I', 'H', 'D', 'R'};
+			std::array<uint8_t, 4> crc{};
+			if (length != ihdr_size || !m_file.read(reinterpret_cast<char*>(chunk.data() + 4), ihdr_size) || !m_file.read(reinterpret_cast<char*>(crc.data()), crc.size()))
+			{
+				return false;
+			}
+
+			if (!parse_header(chunk.data() + 4, m_width, m_height, m_channels) || (verify_crc && update_crc(0, chunk.data(), chunk.size()) != read_u32(crc.data())))
+			{
+				return false;
+			}
+
+			has_header = true;
+		}
+		else if (type == "IDAT")
+		{
+			m_idat_left = length;
+			m_crc		= update_crc(0, reinterpret_cast<const uint8_t*>(type.data()), type.size());
+
+			if (m_idat_left == 0)
+			{
+				finish_chunk();
+			}
+
+			return has_header;
+		}
+		else if (type == "tRNS" || type == "IEND")
+		{
+			// stb expands tRNS to an extra alpha channel, leave those files to it
+			return false;
+		}
+		else
+		{
+			m_file.seekg(static_cast<std::streamoff>(length) + 4, std::ios::cur);
+		}
+	}
+
+	return false;
+}
+
+auto png_reader::fill_input() -> void
+{
+	// Move on to the next IDAT chunk once the current one is used up, its CRC has been read already
+	while (m_idat_left == 0)
+	{
+		uint32_t length = 0;
+		std::string type;
+
+		if (!read_chunk_header(length, type) || type != "IDAT")
+		{
+			throw std::runtime_error("Truncated PNG data: " + m_file_path);
+		}
+
+		m_idat_left = length;
+		m_crc		= update_crc(0, reinterpret_cast<const uint8_t*>(type.data()), type.size());
+
+		if (m_idat_left == 0)
+		{
+			finish_chunk();
+		}
+	}
+
+	const auto count = std::min<size_t>(m_idat_left, m_input.size());
+	if (!m_file.read(reinterpret_cast<char*>(m_input.data()), static_cast<std::streamsize>(count)))
+	{
+		throw std::runtime_error("Truncated PNG data: " + m_file_path);
+	}
+
+	m_idat_left -= static_cast<uint32_t>(count);
+
+	if (verify_crc)
+	{
+		m_crc = update_crc(m_crc, m_input.data(), count);
+	}
+
+	if (m_idat_left == 0)
+	{
+		finish_chunk();
+	}
+
+	m_stream.next_in  = m_input.data();
+	m_stream.avail_in = static_cast<uInt>(count);
+}
+
+auto png_reader::finish_chunk() -> void
+{
+	std::array<uint8_t, 4> crc{};
+	if (!m_file.read(reinterpret_cast<char*>(crc.data()), crc.size()))
+	{
+		throw std::runtime_error("Truncated PNG data: " + m_file_path);
+	}
+
+	if (verify_crc && read_u32(crc.data()) != m_crc)
+	{
+		throw std::runtime_error("PNG CRC mismatch: " + m_file_path);
+	}
+}
+
+auto png_reader::read_row() -> const uint8_t*
+{
+	if (m_next_row >= m_height || m_stream_done)
+	{
+		throw std::runtime_error("Read past the last PNG row: " + m_file_path);
+	}
+
+	if (!m_stream_ready)
+	{
+		if (inflateInit(&m_stream) != Z_OK)
+		{
+			throw std::runtime_error("Failed to initialise inflate: " + m_file_path);
+		}
+
+		m_stream_ready = true;
+
+		m_input.resize(input_window);
+		m_row.resize(get_stride() + 1);
+		m_prev_row.assign(get_stride() + 1, 0);
+	}
+
+	m_stream.next_out  = m_row.data();
+	m_stream.avail_out = static_cast<uInt>(m_row.size());
+
+	while (m_stream.avail_out > 0)
+	{
+		if (m_stream.avail_in == 0)
+		{
+			fill_input();
+		}
+
+		const auto result = inflate(&m_stream, Z_NO_FLUSH);
+
+		if (result == Z_STREAM_END)
+		{
+			m_stream_done = m_stream.avail_out > 0;
+			break;
+		}
+
+		if (result != Z_OK && result != Z_BUF_ERROR)
+		{
+			throw std::runtime_error("Corrupt PNG data: " + m_file_path);
+		}
+	}
+
+	if (m_stream_done)
+	{
+		throw std::runtime_error("Truncated PNG data: " + m_file_path);
+	}
+
+	// A clear row is already what unfiltering it would give
+	m_row_clear = is_clear_row(m_row[0], m_row.data() + 1, get_stride(), m_row_clear);
+	if (!m_row_clear)
+	{
+		unfilter(m_row[0], m_row.data() + 1, m_prev_row.data() + 1);
+	}
+
+	std::swap(m_row, m_prev_row);
+	++m_next_row;
+
+	return m_prev_row.data() + 1;
+}
+
+auto png_reader::unfilter(uint8_t in_filter, uint8_t* ptr_row, const uint8_t* ptr_prev) const -> void
+{
+	if (!unfilter_row(in_filter, ptr_row, ptr_prev, m_channels, get_stride()))
+	{
+		throw std::runtime_error("Invalid PNG filter: " + m_file_path);
+	}
+}
+
+auto png_reader::decode(const std::string& in_file_path) -> pixel_buffer
+{
+	std::ifstream file(in_file_path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open PNG: " + in_file_path);
+	}
+
+	std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())))
+	{
+		throw std::runtime_error("Failed to read PNG: " + in_file_path);
+	}
+
+	if (data.size() < png_signature.size() || !std::equal(png_signature.begin(), png_signature.end(), data.begin()))
+	{
+		throw std::runtime_error("Not a PNG file: " + in_file_path);
+	}
+
+	pixel_buffer result{};
+	bool has_header = false;
+
+	// Encoders split the data into IDAT chunks of 8 to 64 KB, the inflater wants it in one piece
+	std::vector<uint8_t> compressed;
+	compressed.reserve(data.size());
+
+	for (size_t pos = png_signature.size(); pos + 12 <= data.size();)
+	{
+		const auto length	 = static_cast<size_t>(read_u32(data.data() + pos));
+		const auto* ptr_type = data.data() + pos + 4;
+		const auto* ptr_body = ptr_type + 4;
+
+		if (length > data.size() - pos - 12)
+		{
+			throw std::runtime_error("Truncated PNG data: " + in_file_path);
+		}
+
+		const bool is_header = std::memcmp(ptr_type, "IHDR", 4) == 0;
+		const bool is_data	 = std::memcmp(ptr_type, "IDAT", 4) == 0;
+
+		if ((is_header || is_data) && verify_crc && update_crc(0, ptr_type, length + 4) != read_u32(ptr_body + length))
+		{
+			throw std::runtime_error("PNG CRC mismatch: " + in_file_path);
+		}
+
+		if (is_header)
+		{
+			if (length != ihdr_size || !parse_header(ptr_body, result.width, result.height, result.channels))
+			{
+				throw std::runtime_error("Unsupported PNG layout: " + in_file_path);
+			}
+
+			has_header = true;
+		}
+		else if (is_data)
+		{
+			compressed.insert(compressed.end(), ptr_body, ptr_body + length);
+		}
+		else if (std::memcmp(ptr_type, "tRNS", 4) == 0)
+		{
+			throw std::runtime_error("Unsupported PNG layout: " + in_file_path);
+		}
+		else if (std::memcmp(ptr_type, "IEND", 4) == 0)
+		{
+			break;
+		}
+
+		pos += length + 12;
+	}
+
+	if (!has_header || compressed.empty())
+	{
+		throw std::runtime_error("Truncated PNG data: " + in_file_path);
+	}
+
+	std::vector<uint8_t>().swap(data);
+
+	// Every row is inflated with its filter byte in front, then unfiltered and moved down over the filter bytes before it
+	const auto stride = static_cast<size_t>(result.width) * result.channels;
+	const auto height = static_cast<size_t>(result.height);
+
+	result.pixels.resize((stride + 1) * height);
+	inflate_all(compressed, result.pixels, in_file_path);
+	std::vector<uint8_t>().swap(compressed);
+
+	const std::vector<uint8_t> zero_row(stride, 0);
+	uint8_t* ptr_pixels = result.pixels.data();
+	bool prev_clear		= true;
+
+	result.clear_rows.assign(height, 0);
+
+	for (size_t pos_y = 0; pos_y < height; ++pos_y)
+	{
+		const auto filter		= ptr_pixels[pos_y * (stride + 1)];
+		const auto* ptr_payload = ptr_pixels + pos_y * (stride + 1) + 1;
+		auto* ptr_row			= ptr_pixels + pos_y * stride;
+
+		// Transparent margins of sprites inflate to zero rows, they are flagged for the scanners and never unfiltered
+		prev_clear = is_clear_row(filter, ptr_payload, stride, prev_clear);
+		if (prev_clear)
+		{
+			result.clear_rows[pos_y] = 1;
+			std::memset(ptr_row, 0, stride);
+			continue;
+		}
+
+		std::memmove(ptr_row, ptr_payload, stride);
+
+		if (!unfilter_row(filter, ptr_row, pos_y == 0 ? zero_row.data() : ptr_row - stride, result.channels, stride))
+		{
+			throw std::runtime_error("Invalid PNG filter: " + in_file_path);
+		}
+	}
+
+	result.pixels.resize(stride * height);
+
+	return result;
+}
+
+auto png_reader::set_verify_crc(bool in_verify) -> void { verify_crc = in_verify; }
+
+auto png_reader::get_inflater_name() -> const char* { return TRIMMER_HAS_LIBDEFLATE != 0 ? "libdeflate" : "zlib"; }
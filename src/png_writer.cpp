@@ -0,0 +1,1104 @@
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+#include "compress.hpp"
+#include "file_sink.hpp"
+#include "quantizer.hpp"
+#include "stb_image_write.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PNG_WRITER_X86 1
+#endif
+
+namespace
+{
+	constexpr std::array<uint8_t, 8> png_signature = {137, 80, 78, 71, 13, 10, 26, 10};
+	constexpr size_t output_window				   = size_t{256} * 1024;
+	constexpr size_t num_filters				   = 5;
+	// Raw bytes per strip when one image is split across the pool
+	constexpr size_t parallel_strip_size		   = size_t{1} << 20;
+
+	constexpr uint8_t all_filters = 0b11111;
+
+	// Colour counts encoded at once per round of the budget search, and rounds before it settles for the best so far
+	constexpr size_t search_width	   = 4;
+	constexpr size_t max_search_rounds = 5;
+
+	struct effort_settings
+	{
+		int32_t level;
+		int32_t mem_level;
+		int32_t strategy;
+		// Bit i set => filter i is a candidate for every row
+		uint8_t filter_mask;
+		// Candidates are ranked by their deflated size instead of the residual heuristic
+		bool brute_force;
+	};
+
+	auto get_settings(png_effort in_effort) -> effort_settings
+	{
+		switch (in_effort)
+		{
+		case png_effort::fast:
+			return {1, 8, Z_DEFAULT_STRATEGY, 0b00111, false};
+		case png_effort::small:
+			return {9, 9, Z_DEFAULT_STRATEGY, all_filters, false};
+		default:
+			return {6, 8, Z_DEFAULT_STRATEGY, all_filters, false};
+		}
+	}
+
+	struct trial
+	{
+		effort_settings settings;
+		std::string name;
+	};
+
+	// Every filter strategy crossed with every deflate strategy, all at the highest level
+	auto get_optimize_trials() -> std::vector<trial>
+	{
+		const std::array<std::pair<uint8_t, const char*>, 6> filters = {{{0b00001, "none"}, {0b00010, "sub"}, {0b00100, "up"}, {0b01000, "avg"}, {0b10000, "paeth"}, {all_filters, "heuristic"}}};
+		const std::array<std::pair<int32_t, const char*>, 3> strategies = {{{Z_DEFAULT_STRATEGY, "default"}, {Z_FILTERED, "filtered"}, {Z_RLE, "rle"}}};
+
+		std::vector<trial> trials;
+
+		for (const auto& [strategy, strategy_name] : strategies)
+		{
+			for (const auto& [filter_mask, filter_name] : filters)
+			{
+				trials.push_back({{9, 9, strategy, filter_mask, false}, std::string(filter_name) + "/" + strategy_name});
+			}
+
+			trials.push_back({{9, 9, strategy, all_filters, true}, std::string("brute force/") + strategy_name});
+		}
+
+		return trials;
+	}
+
+	auto write_u32(uint8_t* ptr_bytes, uint32_t in_value) -> void
+	{
+		ptr_bytes[0] = static_cast<uint8_t>(in_value >> 24);
+		ptr_bytes[1] = static_cast<uint8_t>(in_value >> 16);
+		ptr_bytes[2] = static_cast<uint8_t>(in_value >> 8);
+		ptr_bytes[3] = static_cast<uint8_t>(in_value);
+	}
+
+	auto write_chunk(const png_writer::byte_sink& in_sink, const char* ptr_type, const uint8_t* ptr_data, size_t in_size) -> size_t
+	{
+		std::array<uint8_t, 8> header{};
+		write_u32(header.data(), static_cast<uint32_t>(in_size));
+		std::memcpy(header.data() + 4, ptr_type, 4);
+
+		auto crc = crc32(0, header.data() + 4, 4);
+		if (in_size > 0)
+		{
+			crc = crc32_z(crc, ptr_data, in_size);
+		}
+
+		std::array<uint8_t, 4> footer{};
+		write_u32(footer.data(), static_cast<uint32_t>(crc));
+
+		in_sink(header.data(), header.size());
+		if (in_size > 0)
+		{
+			in_sink(ptr_data, in_size);
+		}
+		in_sink(footer.data(), footer.size());
+
+		return header.size() + in_size + footer.size();
+	}
+
+	// Where the rows come from and how IHDR describes them, stride is in bytes without the filter byte
+	struct png_layout
+	{
+		int32_t width;
+		int32_t height;
+		uint8_t bit_depth;
+		uint8_t color_type;
+		size_t bpp;
+		size_t stride;
+	};
+
+	auto get_color_type(size_t in_channels) -> uint8_t
+	{
+		switch (in_channels)
+		{
+		case 1:
+			return 0;
+		case 2:
+			return 4;
+		case 3:
+			return 2;
+		case 4:
+			return 6;
+		default:
+			throw std::runtime_error("Unsupported channel count for PNG");
+		}
+	}
+
+	auto paeth(int32_t in_left, int32_t in_up, int32_t in_up_left) -> uint8_t
+	{
+		const int32_t dist_left	 = std::abs(in_up - in_up_left);
+		const int32_t dist_up	 = std::abs(in_left - in_up_left);
+		const int32_t dist_upper = std::abs(in_left + in_up - 2 * in_up_left);
+
+		if (dist_left <= dist_up && dist_left <= dist_upper)
+		{
+			return static_cast<uint8_t>(in_left);
+		}
+
+		return static_cast<uint8_t>(dist_up <= dist_upper ? in_up : in_up_left);
+	}
+
+	// Residuals of filter in_filter for the bytes in [in_begin, in_end) of the row
+	auto filter_scalar(uint8_t in_filter, const uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_bpp, size_t in_begin, size_t in_end, uint8_t* ptr_out) -> void
+	{
+		for (size_t idx = in_begin; idx < in_end; ++idx)
+		{
+			const uint8_t left	  = idx >= in_bpp ? ptr_row[idx - in_bpp] : 0;
+			const uint8_t up	  = ptr_prev[idx];
+			const uint8_t up_left = idx >= in_bpp ? ptr_prev[idx - in_bpp] : 0;
+
+			uint8_t predictor = 0;
+
+			switch (in_filter)
+			{
+			case 1:
+				predictor = left;
+				break;
+			case 2:
+				predictor = up;
+				break;
+			case 3:
+				predictor = static_cast<uint8_t>((left + up) >> 1);
+				break;
+			case 4:
+				predictor = paeth(left, up, up_left);
+				break;
+			default:
+				break;
+			}
+
+			ptr_out[idx] = static_cast<uint8_t>(ptr_row[idx] - predictor);
+		}
+	}
+
+#ifdef PNG_WRITER_X86
+	auto abs_epi16(__m128i in_value) -> __m128i { return _mm_max_epi16(in_value, _mm_sub_epi16(_mm_setzero_si128(), in_value)); }
+
+	// Paeth predictor for 8 bytes widened to 16 bits
+	auto paeth_epi16(__m128i in_left, __m128i in_up, __m128i in_up_left) -> __m128i
+	{
+		const __m128i dist_left	 = abs_epi16(_mm_sub_epi16(in_up, in_up_left));
+		const __m128i dist_up	 = abs_epi16(_mm_sub_epi16(in_left, in_up_left));
+		const __m128i dist_upper = abs_epi16(_mm_sub_epi16(_mm_add_epi16(in_left, in_up), _mm_add_epi16(in_up_left, in_up_left)));
+
+		const __m128i not_left = _mm_or_si128(_mm_cmpgt_epi16(dist_left, dist_up), _mm_cmpgt_epi16(dist_left, dist_upper));
+		const __m128i not_up   = _mm_cmpgt_epi16(dist_up, dist_upper);
+
+		const __m128i up_or_upper = _mm_or_si128(_mm_andnot_si128(not_up, in_up), _mm_and_si128(not_up, in_up_left));
+		return _mm_or_si128(_mm_andnot_si128(not_left, in_left), _mm_and_si128(not_left, up_or_upper));
+	}
+
+	// Same as filter_scalar over the whole row, the bytes before the first full pixel to the left and the tail go through the scalar loop
+	auto filter_row(uint8_t in_filter, const uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_bpp, size_t in_stride, uint8_t* ptr_out) -> void
+	{
+		const size_t head = std::min(in_bpp, in_stride);
+		filter_scalar(in_filter, ptr_row, ptr_prev, in_bpp, 0, head, ptr_out);
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one  = _mm_set1_epi8(1);
+
+		size_t idx = head;
+		for (; idx + 16 <= in_stride; idx += 16)
+		{
+			const __m128i row	  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_row + idx));
+			const __m128i left	  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_row + idx - in_bpp));
+			const __m128i up	  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_prev + idx));
+			const __m128i up_left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_prev + idx - in_bpp));
+
+			__m128i predictor = zero;
+
+			switch (in_filter)
+			{
+			case 1:
+				predictor = left;
+				break;
+			case 2:
+				predictor = up;
+				break;
+			case 3:
+				// _mm_avg_epu8 rounds up, PNG rounds down
+				predictor = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+				break;
+			case 4:
+			{
+				const __m128i low  = paeth_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(up, zero), _mm_unpacklo_epi8(up_left, zero));
+				const __m128i high = paeth_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(up, zero), _mm_unpackhi_epi8(up_left, zero));
+				predictor		   = _mm_packus_epi16(low, high);
+				break;
+			}
+			default:
+				break;
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_out + idx), _mm_sub_epi8(row, predictor));
+		}
+
+		filter_scalar(in_filter, ptr_row, ptr_prev, in_bpp, idx, in_stride, ptr_out);
+	}
+
+	// Sum of the absolute residuals read as signed bytes, the usual minimum sum of absolute differences heuristic
+	auto get_row_cost(const uint8_t* ptr_residuals, size_t in_count) -> uint64_t
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sum		   = zero;
+
+		size_t idx = 0;
+		for (; idx + 16 <= in_count; idx += 16)
+		{
+			const __m128i residuals = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_residuals + idx));
+			const __m128i magnitude = _mm_min_epu8(residuals, _mm_sub_epi8(zero, residuals));
+
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(magnitude, zero));
+		}
+
+		uint64_t cost = static_cast<uint64_t>(_mm_cvtsi128_si64(sum)) + static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum)));
+
+		for (; idx < in_count; ++idx)
+		{
+			cost += std::min<uint32_t>(ptr_residuals[idx], 256 - ptr_residuals[idx]);
+		}
+
+		return cost;
+	}
+#else
+	auto filter_row(uint8_t in_filter, const uint8_t* ptr_row, const uint8_t* ptr_prev, size_t in_bpp, size_t in_stride, uint8_t* ptr_out) -> void
+	{
+		filter_scalar(in_filter, ptr_row, ptr_prev, in_bpp, 0, in_stride, ptr_out);
+	}
+
+	auto get_row_cost(const uint8_t* ptr_residuals, size_t in_count) -> uint64_t
+	{
+		uint64_t cost = 0;
+
+		for (size_t idx = 0; idx < in_count; ++idx)
+		{
+			cost += std::min<uint32_t>(ptr_residuals[idx], 256 - ptr_residuals[idx]);
+		}
+
+		return cost;
+	}
+#endif
+
+	// Owns the deflate state so it is freed on every exit path, negative window bits give a raw deflate stream without zlib header and trailer
+	struct deflate_stream
+	{
+		z_stream stream{};
+
+		deflate_stream(int32_t in_level, int32_t in_mem_level, int32_t in_window_bits, int32_t in_strategy = Z_DEFAULT_STRATEGY)
+		{
+			if (deflateInit2(&stream, in_level, Z_DEFLATED, in_window_bits, in_mem_level, in_strategy) != Z_OK)
+			{
+				throw std::runtime_error("Failed to initialise deflate");
+			}
+		}
+
+		~deflate_stream() { deflateEnd(&stream); }
+
+		deflate_stream(const deflate_stream&)					 = delete;
+		deflate_stream(deflate_stream&&)						 = delete;
+		auto operator=(const deflate_stream&) -> deflate_stream& = delete;
+	};
+
+	// Picks the filter for each row, the result starts with the filter type byte
+	class row_filter
+	{
+	  public:
+		row_filter(const effort_settings& in_settings, size_t in_bpp, size_t in_stride) : m_filter_mask(in_settings.filter_mask), m_bpp(in_bpp), m_stride(in_stride)
+		{
+			for (size_t filter = 0; filter < num_filters; ++filter)
+			{
+				m_candidates[filter].resize(in_stride + 1);
+				m_candidates[filter][0] = static_cast<uint8_t>(filter);
+			}
+
+			// The fastest level ranks the candidates about as well as the real one at a fraction of the cost
+			if (in_settings.brute_force)
+			{
+				m_estimator.emplace(1, 8, 15, in_settings.strategy);
+				m_scratch.resize(deflateBound(&m_estimator->stream, in_stride + 1));
+			}
+		}
+
+		auto apply(const uint8_t* ptr_row, const uint8_t* ptr_prev) -> const uint8_t*
+		{
+			size_t best_filter = 0;
+			uint64_t best_cost = std::numeric_limits<uint64_t>::max();
+
+			for (size_t filter = 0; filter < num_filters; ++filter)
+			{
+				if ((m_filter_mask & (1U << filter)) == 0)
+				{
+					continue;
+				}
+
+				uint8_t* ptr_out = m_candidates[filter].data() + 1;
+				filter_row(static_cast<uint8_t>(filter), ptr_row, ptr_prev, m_bpp, m_stride, ptr_out);
+
+				const auto cost = m_estimator ? get_deflated_size(m_candidates[filter]) : get_row_cost(ptr_out, m_stride);
+				if (cost < best_cost)
+				{
+					best_cost	= cost;
+					best_filter = filter;
+				}
+			}
+
+			return m_candidates[best_filter].data();
+		}
+
+	  private:
+		uint8_t m_filter_mask;
+		size_t m_bpp;
+		size_t m_stride;
+
+		std::array<std::vector<uint8_t>, num_filters> m_candidates;
+
+		std::optional<deflate_stream> m_estimator;
+		std::vector<uint8_t> m_scratch;
+
+		auto get_deflated_size(std::vector<uint8_t>& in_candidate) -> uint64_t
+		{
+			auto& stream = m_estimator->stream;
+			deflateReset(&stream);
+
+			stream.next_in	 = in_candidate.data();
+			stream.avail_in	 = static_cast<uInt>(in_candidate.size());
+			stream.next_out	 = m_scratch.data();
+			stream.avail_out = static_cast<uInt>(m_scratch.size());
+
+			deflate(&stream, Z_FINISH);
+
+			return stream.total_out;
+		}
+	};
+
+	// Buffers the compressed stream and cuts it into IDAT chunks of the output window size
+	class idat_stream
+	{
+	  public:
+		explicit idat_stream(const png_writer::byte_sink& in_sink) : m_sink(in_sink) { m_pending.reserve(output_window); }
+
+		auto append(const uint8_t* ptr_data, size_t in_size) -> void
+		{
+			while (in_size > 0)
+			{
+				const auto count = std::min(in_size, output_window - m_pending.size());
+				m_pending.insert(m_pending.end(), ptr_data, ptr_data + count);
+
+				ptr_data += count;
+				in_size -= count;
+
+				if (m_pending.size() == output_window)
+				{
+					flush();
+				}
+			}
+		}
+
+		auto flush() -> void
+		{
+			if (!m_pending.empty())
+			{
+				m_written += write_chunk(m_sink, "IDAT", m_pending.data(), m_pending.size());
+				m_pending.clear();
+			}
+		}
+
+		[[nodiscard]] auto get_written() const -> size_t { return m_written; }
+
+	  private:
+		const png_writer::byte_sink& m_sink;
+		std::vector<uint8_t> m_pending;
+		size_t m_written{};
+	};
+
+	// Output of one independently compressed strip of rows
+	struct strip
+	{
+		std::vector<uint8_t> data;
+		uint32_t adler;
+		size_t length;
+	};
+
+	// Deflates rows [in_y_begin, in_y_end) as a raw stream primed with the last window of the rows before it.
+	// Every strip but the last ends on a sync flush, so the outputs concatenate into one deflate stream.
+	auto deflate_strip(const effort_settings& in_settings, const uint8_t* ptr_pixels, size_t in_bpp, size_t in_stride, int32_t in_y_begin, int32_t in_y_end, bool in_is_last)
+		-> strip
+	{
+		constexpr size_t window_size = 32768;
+
+		row_filter filter(in_settings, in_bpp, in_stride);
+		const std::vector<uint8_t> zero_row(in_stride, 0);
+
+		auto get_prev = [&](int32_t in_y) { return in_y > 0 ? ptr_pixels + static_cast<size_t>(in_y - 1) * in_stride : zero_row.data(); };
+
+		deflate_stream compressor(in_settings.level, in_settings.mem_level, -15, in_settings.strategy);
+		auto& stream = compressor.stream;
+
+		// Filtering is deterministic, so the rows of the previous strip are filtered again here instead of waiting for it
+		if (in_y_begin > 0)
+		{
+			const auto dictionary_rows = static_cast<int32_t>((window_size + in_stride) / (in_stride + 1));
+
+			std::vector<uint8_t> dictionary;
+			for (int32_t pos_y = std::max(in_y_begin - dictionary_rows, 0); pos_y < in_y_begin; ++pos_y)
+			{
+				const uint8_t* ptr_filtered = filter.apply(ptr_pixels + static_cast<size_t>(pos_y) * in_stride, get_prev(pos_y));
+				dictionary.insert(dictionary.end(), ptr_filtered, ptr_filtered + in_stride + 1);
+			}
+
+			const auto offset = dictionary.size() > window_size ? dictionary.size() - window_size : 0;
+			deflateSetDictionary(&stream, dictionary.data() + offset, static_cast<uInt>(dictionary.size() - offset));
+		}
+
+		strip result{{}, static_cast<uint32_t>(adler32(0, nullptr, 0)), static_cast<size_t>(in_y_end - in_y_begin) * (in_stride + 1)};
+		result.data.resize(deflateBound(&stream, result.length) + 16);
+
+		stream.next_out	 = result.data.data();
+		stream.avail_out = static_cast<uInt>(result.data.size());
+
+		for (int32_t pos_y = in_y_begin; pos_y < in_y_end; ++pos_y)
+		{
+			const uint8_t* ptr_filtered = filter.apply(ptr_pixels + static_cast<size_t>(pos_y) * in_stride, get_prev(pos_y));
+			result.adler				= static_cast<uint32_t>(adler32(result.adler, ptr_filtered, static_cast<uInt>(in_stride + 1)));
+
+			stream.next_in	= const_cast<uint8_t*>(ptr_filtered);
+			stream.avail_in = static_cast<uInt>(in_stride + 1);
+
+			const auto flush  = pos_y + 1 < in_y_end ? Z_NO_FLUSH : (in_is_last ? Z_FINISH : Z_SYNC_FLUSH);
+			const auto status = deflate(&stream, flush);
+
+			// The output is sized by deflateBound, running out of it means the stream is broken
+			if (status == Z_STREAM_ERROR || stream.avail_in != 0)
+			{
+				throw std::runtime_error("Failed to deflate image strip");
+			}
+		}
+
+		result.data.resize(result.data.size() - stream.avail_out);
+
+		return result;
+	}
+
+	auto deflate_serial(const png_writer::byte_sink& in_sink, const effort_settings& in_settings, const uint8_t* ptr_pixels, size_t in_bpp, size_t in_stride,
+						int32_t in_height) -> void
+	{
+		row_filter filter(in_settings, in_bpp, in_stride);
+		const std::vector<uint8_t> zero_row(in_stride, 0);
+
+		deflate_stream compressor(in_settings.level, in_settings.mem_level, 15, in_settings.strategy);
+		auto& stream = compressor.stream;
+
+		std::vector<uint8_t> output(output_window);
+
+		for (int32_t pos_y = 0; pos_y < in_height; ++pos_y)
+		{
+			const uint8_t* ptr_row = ptr_pixels + static_cast<size_t>(pos_y) * in_stride;
+
+			stream.next_in	= const_cast<uint8_t*>(filter.apply(ptr_row, pos_y > 0 ? ptr_row - in_stride : zero_row.data()));
+			stream.avail_in = static_cast<uInt>(in_stride + 1);
+
+			const auto flush = pos_y + 1 < in_height ? Z_NO_FLUSH : Z_FINISH;
+
+			do
+			{
+				stream.next_out	 = output.data();
+				stream.avail_out = static_cast<uInt>(output.size());
+
+				if (deflate(&stream, flush) == Z_STREAM_ERROR)
+				{
+					throw std::runtime_error("Failed to deflate image");
+				}
+
+				in_sink(output.data(), output.size() - stream.avail_out);
+			} while (stream.avail_out == 0);
+		}
+	}
+
+	// Strips are deflated on the pool like pigz does, then stitched into one zlib stream with the combined Adler-32
+	auto deflate_parallel(thread_pool& in_pool, idat_stream& out_idat, const effort_settings& in_settings, const uint8_t* ptr_pixels, size_t in_bpp, size_t in_stride,
+						  int32_t in_height) -> void
+	{
+		const auto rows_per_strip = static_cast<int32_t>(std::max<size_t>(parallel_strip_size / in_stride, 1));
+		const auto num_strips	  = static_cast<size_t>((in_height + rows_per_strip - 1) / rows_per_strip);
+
+		std::vector<strip> strips(num_strips);
+		std::vector<thread_pool::task> tasks;
+
+		for (size_t idx = 0; idx < num_strips; ++idx)
+		{
+			const auto y_begin = static_cast<int32_t>(idx) * rows_per_strip;
+			const auto y_end   = std::min(y_begin + rows_per_strip, in_height);
+
+			tasks.push_back({static_cast<size_t>(y_end - y_begin) * in_stride, [&, idx, y_begin, y_end]()
+							 { strips[idx] = deflate_strip(in_settings, ptr_pixels, in_bpp, in_stride, y_begin, y_end, idx + 1 == num_strips); }});
+		}
+
+		in_pool.run(std::move(tasks));
+
+		// 32K window deflate, the level hint only has to be in the right bucket
+		const uint8_t level_hint = in_settings.level <= 1 ? 0 : (in_settings.level <= 5 ? 1 : (in_settings.level == 6 ? 2 : 3));
+
+		std::array<uint8_t, 2> zlib_header = {0x78, static_cast<uint8_t>(level_hint << 6)};
+		zlib_header[1] = static_cast<uint8_t>(zlib_header[1] + 31 - ((zlib_header[0] << 8 | zlib_header[1]) % 31));
+
+		out_idat.append(zlib_header.data(), zlib_header.size());
+
+		auto adler = adler32(0, nullptr, 0);
+		for (const auto& current : strips)
+		{
+			out_idat.append(current.data.data(), current.data.size());
+			adler = adler32_combine(adler, current.adler, static_cast<z_off_t>(current.length));
+		}
+
+		std::array<uint8_t, 4> trailer{};
+		write_u32(trailer.data(), static_cast<uint32_t>(adler));
+
+		out_idat.append(trailer.data(), trailer.size());
+	}
+
+	// Runs every trial on the pool and keeps the smallest zlib stream, ties go to the earlier trial so the result does not depend on timing
+	auto deflate_optimized(thread_pool* ptr_pool, const uint8_t* ptr_pixels, size_t in_bpp, size_t in_stride, int32_t in_height, std::string& out_name) -> std::vector<uint8_t>
+	{
+		const auto trials = get_optimize_trials();
+
+		std::mutex best_mutex;
+		std::vector<uint8_t> best;
+		size_t best_trial = trials.size();
+
+		auto run_trial = [&](size_t in_trial)
+		{
+			std::vector<uint8_t> output;
+			deflate_serial([&output](const uint8_t* ptr_data, size_t in_size) { output.insert(output.end(), ptr_data, ptr_data + in_size); }, trials[in_trial].settings, ptr_pixels,
+						   in_bpp, in_stride, in_height);
+
+			std::lock_guard<std::mutex> lock(best_mutex);
+			if (best_trial == trials.size() || output.size() < best.size() || (output.size() == best.size() && in_trial < best_trial))
+			{
+				best.swap(output);
+				best_trial = in_trial;
+			}
+		};
+
+		// Brute force deflates every row five extra times, weigh it accordingly so it starts first
+		std::vector<thread_pool::task> tasks;
+		for (size_t idx = 0; idx < trials.size(); ++idx)
+		{
+			const auto cost = in_stride * static_cast<size_t>(in_height) * (trials[idx].settings.brute_force ? 6 : 1);
+			tasks.push_back({cost, [&run_trial, idx]() { run_trial(idx); }});
+		}
+
+		if (ptr_pool != nullptr)
+		{
+			ptr_pool->run(std::move(tasks));
+		}
+		else
+		{
+			std::for_each(tasks.begin(), tasks.end(), [](auto& current) { current.work(); });
+		}
+
+		out_name = trials[best_trial].name;
+
+		return best;
+	}
+
+	// Signature, header, any palette chunks, the image data and the trailer, in that order
+	auto encode_zlib(const png_writer::byte_sink& in_sink, const std::string& in_file_path, const effort_settings& in_settings, bool in_optimize, thread_pool* ptr_pool,
+					 const uint8_t* ptr_rows, const png_layout& in_layout, const palette* ptr_palette) -> void
+	{
+		// Every trial runs before the first byte goes out, a failure leaves the original in place
+		std::vector<uint8_t> optimized;
+		if (in_optimize)
+		{
+			std::string trial_name;
+			optimized = deflate_optimized(ptr_pool, ptr_rows, in_layout.bpp, in_layout.stride, in_layout.height, trial_name);
+
+			spdlog::debug("Optimized {}: {} bytes of zlib data with {}", in_file_path, optimized.size(), trial_name);
+		}
+
+		in_sink(png_signature.data(), png_signature.size());
+
+		std::array<uint8_t, 13> header{};
+		write_u32(header.data(), static_cast<uint32_t>(in_layout.width));
+		write_u32(header.data() + 4, static_cast<uint32_t>(in_layout.height));
+		header[8] = in_layout.bit_depth;
+		header[9] = in_layout.color_type;
+
+		write_chunk(in_sink, "IHDR", header.data(), header.size());
+
+		if (ptr_palette != nullptr)
+		{
+			std::vector<uint8_t> colors;
+			std::vector<uint8_t> alphas;
+
+			for (const auto& color : *ptr_palette)
+			{
+				colors.insert(colors.end(), color.begin(), color.begin() + 3);
+				alphas.push_back(color[3]);
+			}
+
+			// The palette is sorted by alpha, so tRNS can stop at the last translucent entry
+			while (!alphas.empty() && alphas.back() == 255)
+			{
+				alphas.pop_back();
+			}
+
+			write_chunk(in_sink, "PLTE", colors.data(), colors.size());
+			if (!alphas.empty())
+			{
+				write_chunk(in_sink, "tRNS", alphas.data(), alphas.size());
+			}
+		}
+
+		idat_stream idat(in_sink);
+
+		// Only worth splitting when the pool has idle workers to hand the strips to
+		const auto raw_size = in_layout.stride * static_cast<size_t>(in_layout.height);
+		if (in_optimize)
+		{
+			idat.append(optimized.data(), optimized.size());
+		}
+		else if (ptr_pool != nullptr && ptr_pool->get_num_threads() > 1 && raw_size >= parallel_strip_size * 2)
+		{
+			deflate_parallel(*ptr_pool, idat, in_settings, ptr_rows, in_layout.bpp, in_layout.stride, in_layout.height);
+		}
+		else
+		{
+			deflate_serial([&idat](const uint8_t* ptr_data, size_t in_size) { idat.append(ptr_data, in_size); }, in_settings, ptr_rows, in_layout.bpp, in_layout.stride,
+						   in_layout.height);
+		}
+
+		idat.flush();
+
+		write_chunk(in_sink, "IEND", nullptr, 0);
+	}
+
+	auto get_bit_depth(size_t in_palette_size) -> uint8_t
+	{
+		if (in_palette_size <= 2)
+		{
+			return 1;
+		}
+
+		if (in_palette_size <= 4)
+		{
+			return 2;
+		}
+
+		return in_palette_size <= 16 ? 4 : 8;
+	}
+} // namespace
+
+png_writer::png_writer(png_encoder in_encoder, png_effort in_effort, thread_pool* ptr_pool) : m_encoder(in_encoder), m_effort(in_effort), m_ptr_pool(ptr_pool) {}
+
+auto png_writer::write(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> void
+{
+	m_raw_bytes += static_cast<size_t>(in_width) * static_cast<size_t>(in_height) * in_channels;
+
+	if (m_ptr_quantizer == nullptr && m_ptr_pngquant == nullptr)
+	{
+		file_sink file(in_file_path);
+		encode(std::bind_front(&file_sink::append, &file), in_file_path, ptr_pixels, in_width, in_height, in_channels);
+
+		m_encoded_bytes += file.close();
+		return;
+	}
+
+	// Every frame indexes the shared palette whatever its size, the truecolour encoding would only be thrown away
+	if (m_ptr_shared_palette != nullptr && m_ptr_pngquant == nullptr)
+	{
+		write_quantized(in_file_path, ptr_pixels, in_width, in_height, in_channels, 0);
+		return;
+	}
+
+	// Both encodings are kept in memory, the palette one only wins when it is actually smaller
+	std::vector<uint8_t> truecolor;
+	encode([&truecolor](const uint8_t* ptr_data, size_t in_size) { truecolor.insert(truecolor.end(), ptr_data, ptr_data + in_size); }, in_file_path, ptr_pixels, in_width,
+		   in_height, in_channels);
+
+	if (!precheck(in_file_path, ptr_pixels, in_width, in_height, in_channels, truecolor.size(), false))
+	{
+		m_encoded_bytes += save_file(in_file_path, truecolor);
+		return;
+	}
+
+	if (m_ptr_pngquant != nullptr)
+	{
+		std::vector<uint8_t> compressed;
+		std::string message;
+
+		const auto start  = std::chrono::steady_clock::now();
+		const auto status = m_ptr_pngquant->compress_buffer(truecolor, compressed, message);
+		record_quantize_time(static_cast<size_t>(in_width) * static_cast<size_t>(in_height), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		switch (status)
+		{
+		case compress_status::compressed:
+			m_encoded_bytes += save_file(in_file_path, compressed);
+			++m_quantized_files;
+			return;
+		case compress_status::skipped:
+			++m_truecolor_files;
+			break;
+		default:
+			spdlog::error("pngquant failed on {}: {}", in_file_path, message);
+			++m_failed_files;
+			break;
+		}
+
+		m_encoded_bytes += save_file(in_file_path, truecolor);
+		return;
+	}
+
+	if (!write_quantized(in_file_path, ptr_pixels, in_width, in_height, in_channels, truecolor.size()))
+	{
+		m_encoded_bytes += save_file(in_file_path, truecolor);
+	}
+}
+
+auto png_writer::write_quantized(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, size_t in_size_limit) -> bool
+{
+	if (m_ptr_quantizer == nullptr)
+	{
+		throw std::runtime_error("No quantizer set for: " + in_file_path);
+	}
+
+	const auto start	   = std::chrono::steady_clock::now();
+	const auto pixel_count = static_cast<size_t>(in_width) * static_cast<size_t>(in_height);
+	const auto histogram   = m_ptr_shared_palette != nullptr ? std::vector<color_count>{} : quantizer::build_histogram(ptr_pixels, pixel_count, in_channels);
+	const auto colors	   = m_ptr_shared_palette != nullptr ? *m_ptr_shared_palette : m_ptr_quantizer->build_palette(histogram);
+
+	auto indexed = encode_indexed(in_file_path, m_ptr_quantizer->remap(ptr_pixels, in_width, in_height, in_channels, colors), in_width, in_height, colors, m_effort);
+
+	// A truecolour file within the budget is kept below anyway, a shared palette cannot shrink
+	const auto budget = m_ptr_shared_palette != nullptr ? 0 : get_byte_budget(in_file_path);
+	if (budget > 0 && indexed.size() > budget && in_size_limit > budget)
+	{
+		indexed = search_budget(in_file_path, ptr_pixels, in_width, in_height, in_channels, histogram, budget, std::move(indexed), colors.size());
+	}
+
+	record_quantize_time(pixel_count, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	// Same rule as pngquant --skip-if-larger
+	if (m_ptr_shared_palette == nullptr && indexed.size() >= in_size_limit)
+	{
+		spdlog::debug("Kept {} as truecolour, the palette encodes to {} bytes against {}", in_file_path, indexed.size(), in_size_limit);
+
+		++m_truecolor_files;
+		return false;
+	}
+
+	m_encoded_bytes += save_file(in_file_path, indexed);
+	++m_quantized_files;
+
+	return true;
+}
+
+auto png_writer::encode_indexed(const std::string& in_file_path, const std::vector<uint8_t>& in_indices, int32_t in_width, int32_t in_height, const palette& in_palette,
+								png_effort in_effort) const -> std::vector<uint8_t>
+{
+	const auto bit_depth = get_bit_depth(in_palette.size());
+	const auto stride	 = (static_cast<size_t>(in_width) * bit_depth + 7) / 8;
+
+	// Indices are packed most significant bits first when fewer than 8 bits are needed
+	std::vector<uint8_t> packed;
+	if (bit_depth < 8)
+	{
+		packed.resize(stride * static_cast<size_t>(in_height), 0);
+
+		const size_t per_byte = 8 / bit_depth;
+		for (size_t pos_y = 0; pos_y < static_cast<size_t>(in_height); ++pos_y)
+		{
+			for (size_t pos_x = 0; pos_x < static_cast<size_t>(in_width); ++pos_x)
+			{
+				const auto shift = 8 - bit_depth * (pos_x % per_byte + 1);
+				packed[pos_y * stride + pos_x / per_byte] |= static_cast<uint8_t>(in_indices[pos_y * static_cast<size_t>(in_width) + pos_x] << shift);
+			}
+		}
+	}
+
+	// Filters rarely help indexed rows, only the optimize trials get to try them
+	auto settings		 = get_settings(in_effort);
+	settings.filter_mask = 0b00001;
+
+	const png_layout layout{in_width, in_height, bit_depth, 3, 1, stride};
+
+	std::vector<uint8_t> indexed;
+	encode_zlib([&indexed](const uint8_t* ptr_data, size_t in_size) { indexed.insert(indexed.end(), ptr_data, ptr_data + in_size); }, in_file_path, settings, m_optimize,
+				m_ptr_pool, bit_depth < 8 ? packed.data() : in_indices.data(), layout, &in_palette);
+
+	return indexed;
+}
+
+auto png_writer::search_budget(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels,
+							   const std::vector<color_count>& in_histogram, size_t in_budget, std::vector<uint8_t> in_top, size_t in_top_colors) -> std::vector<uint8_t>
+{
+	struct candidate
+	{
+		size_t colors;
+		std::vector<uint8_t> bytes;
+	};
+
+	++m_searched_files;
+
+	// The deflated indices grow about with log2 of the colour count, scaled by how far that guess was off on the images searched before
+	const auto top_size	  = static_cast<double>(in_top.size());
+	const auto top_bits	  = std::log2(static_cast<double>(std::max<size_t>(in_top_colors, 2)));
+	const auto correction = m_search_predicted_bytes > 0 ? static_cast<double>(m_search_actual_bytes) / static_cast<double>(m_search_predicted_bytes) : 1.0;
+	const auto predict	  = [top_size, top_bits](size_t in_colors) { return top_size * std::log2(static_cast<double>(in_colors)) / top_bits; };
+	const auto seed = static_cast<size_t>(std::clamp(std::exp2(top_bits * static_cast<double>(in_budget) / (top_size * correction)), 2.0, static_cast<double>(in_top_colors)));
+
+	// The small effort only costs time, which the parallel candidates hide, the optimize trials already cover every setting
+	std::vector<png_effort> efforts{m_effort};
+	if (m_effort != png_effort::small && !m_optimize)
+	{
+		efforts.push_back(png_effort::small);
+	}
+
+	// fit_colors encodes within the budget and fail_colors does not, 1 colour stands for an image that always fits
+	size_t fit_colors  = 1;
+	size_t fail_colors = in_top_colors;
+
+	candidate best{0, {}};
+	candidate smallest{in_top_colors, std::move(in_top)};
+
+	const auto pixel_count = static_cast<size_t>(in_width) * static_cast<size_t>(in_height);
+
+	// A few colours more or less are invisible in the larger palettes, the search stops within a sixteenth of what fits
+	for (size_t round = 0; round < max_search_rounds && fail_colors - fit_colors > std::max<size_t>(fit_colors / 16, 1); ++round)
+	{
+		// The first round brackets the seed, the next ones split what is left evenly on a log scale like the model
+		std::vector<size_t> points;
+		if (round == 0)
+		{
+			points = {seed / 2, seed, seed * 2};
+		}
+		else
+		{
+			const auto span = std::log2(static_cast<double>(fail_colors) / static_cast<double>(fit_colors));
+			for (size_t idx = 1; idx <= search_width; ++idx)
+			{
+				points.push_back(static_cast<size_t>(std::lround(static_cast<double>(fit_colors) * std::exp2(span * static_cast<double>(idx) / (search_width + 1)))));
+			}
+		}
+
+		std::erase_if(points, [fit_colors, fail_colors](size_t in_colors) { return in_colors <= fit_colors || in_colors >= fail_colors; });
+		std::sort(points.begin(), points.end());
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+
+		if (points.empty())
+		{
+			points.push_back(fit_colors + (fail_colors - fit_colors) / 2);
+		}
+
+		std::vector<candidate> results(points.size());
+		std::vector<thread_pool::task> tasks;
+
+		for (size_t idx = 0; idx < points.size(); ++idx)
+		{
+			tasks.push_back({pixel_count, [&, idx]()
+							 {
+								 const quantizer candidate_quantizer(points[idx], m_ptr_quantizer->get_dither());
+
+								 const auto colors	= candidate_quantizer.build_palette(in_histogram);
+								 const auto indices = candidate_quantizer.remap(ptr_pixels, in_width, in_height, in_channels, colors);
+
+								 results[idx].colors = points[idx];
+								 for (const auto effort : efforts)
+								 {
+									 auto bytes = encode_indexed(in_file_path, indices, in_width, in_height, colors, effort);
+									 if (results[idx].bytes.empty() || bytes.size() < results[idx].bytes.size())
+									 {
+										 results[idx].bytes = std::move(bytes);
+									 }
+								 }
+							 }});
+		}
+
+		if (m_ptr_pool != nullptr)
+		{
+			m_ptr_pool->run(std::move(tasks));
+		}
+		else
+		{
+			std::for_each(tasks.begin(), tasks.end(), [](const thread_pool::task& in_task) { in_task.work(); });
+		}
+
+		m_search_encodes += points.size() * efforts.size();
+
+		// Sizes are not strictly monotonic in the colour count, the bracket follows the most colours that fit
+		for (auto& result : results)
+		{
+			if (result.bytes.size() <= in_budget && result.colors > fit_colors)
+			{
+				fit_colors = result.colors;
+				best	   = result;
+			}
+		}
+
+		for (auto& result : results)
+		{
+			if (result.bytes.size() > in_budget && result.colors > fit_colors)
+			{
+				fail_colors = std::min(fail_colors, result.colors);
+			}
+
+			if (result.bytes.size() < smallest.bytes.size())
+			{
+				smallest = std::move(result);
+			}
+		}
+	}
+
+	if (best.bytes.empty())
+	{
+		spdlog::warn("No palette of {} fits in {} bytes, the smallest takes {} with {} colours", in_file_path, in_budget, smallest.bytes.size(), smallest.colors);
+
+		++m_over_budget_files;
+		return std::move(smallest.bytes);
+	}
+
+	m_search_actual_bytes += best.bytes.size();
+	m_search_predicted_bytes += static_cast<uint64_t>(predict(best.colors));
+
+	spdlog::debug("Budget search for {}: {} colours in {} bytes against {}, seeded at {}", in_file_path, best.colors, best.bytes.size(), in_budget, seed);
+
+	return std::move(best.bytes);
+}
+
+auto png_writer::get_byte_budget(const std::string& in_file_path) const -> size_t
+{
+	const auto found = m_file_budgets.find(in_file_path);
+	return found != m_file_budgets.end() ? found->second : m_max_bytes;
+}
+
+auto png_writer::get_working_size(size_t in_pixel_count, size_t in_channels) const -> size_t
+{
+	size_t working_size = 0;
+
+	// The optimize trials run side by side on the pool, each one holds a whole zlib stream until the smallest is kept
+	if (m_optimize && m_encoder == png_encoder::zlib)
+	{
+		const auto threads	= m_ptr_pool != nullptr ? m_ptr_pool->get_num_threads() : 1;
+		const auto raw_size = in_pixel_count * (in_channels + 1);
+
+		working_size += std::min(get_optimize_trials().size(), threads) * deflateBound(nullptr, static_cast<uLong>(raw_size));
+	}
+
+	if (m_ptr_quantizer == nullptr && m_ptr_pngquant == nullptr)
+	{
+		return working_size;
+	}
+
+	// Every search candidate holds its indices and encoding at once
+	const bool has_budget = m_max_bytes > 0 || !m_file_budgets.empty();
+	return working_size + in_pixel_count * (10 + in_channels + (has_budget ? search_width * 2 : 0));
+}
+
+auto png_writer::precheck(const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, size_t in_encoded_size,
+						  bool in_is_paletted) -> bool
+{
+	const auto budget = get_byte_budget(in_file_path);
+	if (budget > 0 && in_encoded_size > budget)
+	{
+		return true;
+	}
+
+	const auto pixel_count = static_cast<size_t>(in_width) * static_cast<size_t>(in_height);
+	const auto probe	   = in_is_paletted ? color_probe{} : quantizer::probe(ptr_pixels, in_width, in_height, in_channels);
+
+	switch (quantizer::classify(probe, in_is_paletted, in_encoded_size, pixel_count))
+	{
+	case compress_class::paletted:
+		++m_paletted_files;
+		break;
+	case compress_class::skip:
+		spdlog::debug("Pre-check skipped {} colours at {:.2f} bits of entropy in {} bytes", probe.unique_colors, probe.entropy, in_encoded_size);
+		++m_hopeless_files;
+		break;
+	default:
+		return true;
+	}
+
+	m_skipped_pixels += pixel_count;
+	return false;
+}
+
+auto png_writer::record_quantize_time(size_t in_pixel_count, double in_seconds) -> void
+{
+	m_quantized_pixels += in_pixel_count;
+	m_quantize_nanoseconds += static_cast<uint64_t>(in_seconds * 1e9);
+}
+
+auto png_writer::get_saved_seconds() const -> double
+{
+	return m_quantized_pixels == 0 ? 0.0 : static_cast<double>(m_skipped_pixels) * static_cast<double>(m_quantize_nanoseconds) / static_cast<double>(m_quantized_pixels) / 1e9;
+}
+
+auto png_writer::write_palette(const std::string& in_file_path, const palette& in_palette) const -> void
+{
+	std::vector<uint8_t> indices(in_palette.size());
+	std::iota(indices.begin(), indices.end(), uint8_t{0});
+
+	auto settings		 = get_settings(m_effort);
+	settings.filter_mask = 0b00001;
+
+	const png_layout layout{static_cast<int32_t>(in_palette.size()), 1, 8, 3, 1, in_palette.size()};
+
+	file_sink file(in_file_path);
+	encode_zlib(std::bind_front(&file_sink::append, &file), in_file_path, settings, false, nullptr, indices.data(), layout, &in_palette);
+	file.close();
+}
+
+auto png_writer::get_encoder_name() const -> const char* { return m_encoder == png_encoder::stb ? "stb" : "zlib"; }
+
+auto png_writer::encode(const byte_sink& in_sink, const std::string& in_file_path, const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) const -> void
+{
+	const auto stride = static_cast<size_t>(in_width) * in_channels;
+
+	if (m_encoder == png_encoder::stb)
+	{
+		auto forward = [](void* ptr_context, void* ptr_data, int32_t in_size)
+		{ (*static_cast<const byte_sink*>(ptr_context))(static_cast<const uint8_t*>(ptr_data), static_cast<size_t>(in_size)); };
+
+		if (stbi_write_png_to_func(forward, const_cast<byte_sink*>(&in_sink), in_width, in_height, static_cast<int32_t>(in_channels), ptr_pixels, static_cast<int32_t>(stride)) == 0)
+		{
+			throw std::runtime_error("Failed to write image: " + in_file_path);
+		}
+
+		return;
+	}
+
+	const png_layout layout{in_width, in_height, 8, get_color_type(in_channels), in_channels, stride};
+	encode_zlib(in_sink, in_file_path, get_settings(m_effort), m_optimize, m_ptr_pool, ptr_pixels, layout, nullptr);
+}
@@ -0,0 +1,309 @@
+#include "qoi.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+	constexpr std::array<uint8_t, 4> qoi_magic = {'q', 'o', 'i', 'f'};
+	constexpr size_t header_size			   = 14;
+	constexpr std::array<uint8_t, 8> end_marker = {0, 0, 0, 0, 0, 0, 0, 1};
+
+	constexpr uint8_t op_index = 0x00;
+	constexpr uint8_t op_diff  = 0x40;
+	constexpr uint8_t op_luma  = 0x80;
+	constexpr uint8_t op_run   = 0xC0;
+	constexpr uint8_t op_rgb   = 0xFE;
+	constexpr uint8_t op_rgba  = 0xFF;
+	constexpr uint8_t op_mask  = 0xC0;
+
+	// The spec caps files at 400 million pixels so that a decoder can trust the header
+	constexpr size_t max_pixels = 400'000'000;
+
+	struct pixel
+	{
+		uint8_t r;
+		uint8_t g;
+		uint8_t b;
+		uint8_t a;
+
+		auto operator==(const pixel&) const -> bool = default;
+	};
+
+	auto get_hash(const pixel& in_pixel) -> size_t { return (in_pixel.r * 3 + in_pixel.g * 5 + in_pixel.b * 7 + in_pixel.a * 11) % 64; }
+
+	auto read_u32(const uint8_t* ptr_bytes) -> uint32_t
+	{
+		return (static_cast<uint32_t>(ptr_bytes[0]) << 24) | (static_cast<uint32_t>(ptr_bytes[1]) << 16) | (static_cast<uint32_t>(ptr_bytes[2]) << 8)
+			 | static_cast<uint32_t>(ptr_bytes[3]);
+	}
+
+	auto write_u32(std::vector<uint8_t>& out_data, uint32_t in_value) -> void
+	{
+		out_data.push_back(static_cast<uint8_t>(in_value >> 24));
+		out_data.push_back(static_cast<uint8_t>(in_value >> 16));
+		out_data.push_back(static_cast<uint8_t>(in_value >> 8));
+		out_data.push_back(static_cast<uint8_t>(in_value));
+	}
+
+	auto parse_header(const uint8_t* ptr_bytes, const std::string& in_file_path) -> image_header
+	{
+		if (!std::equal(qoi_magic.begin(), qoi_magic.end(), ptr_bytes))
+		{
+			throw std::runtime_error("Not a QOI file: " + in_file_path);
+		}
+
+		const auto width	= read_u32(ptr_bytes + 4);
+		const auto height	= read_u32(ptr_bytes + 8);
+		const auto channels = ptr_bytes[12];
+
+		if (width == 0 || height == 0 || (channels != 3 && channels != 4) || static_cast<size_t>(width) * static_cast<size_t>(height) > max_pixels)
+		{
+			throw std::runtime_error("Invalid QOI header: " + in_file_path);
+		}
+
+		return {static_cast<int32_t>(width), static_cast<int32_t>(height), channels};
+	}
+
+	// Same weights as stb, so a QOI decoded to grey matches a PNG decoded to grey
+	auto get_luma(const pixel& in_pixel) -> uint8_t { return static_cast<uint8_t>((in_pixel.r * 77 + in_pixel.g * 150 + in_pixel.b * 29) >> 8); }
+} // namespace
+
+auto qoi_codec::can_read(const std::string& in_file_path) -> bool
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+
+	std::array<uint8_t, 4> magic{};
+	file.read(reinterpret_cast<char*>(magic.data()), magic.size());
+
+	return file && magic == qoi_magic;
+}
+
+auto qoi_codec::read_header(const std::string& in_file_path) -> image_header
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+
+	std::array<uint8_t, header_size> header{};
+	if (!file.read(reinterpret_cast<char*>(header.data()), header.size()))
+	{
+		throw std::runtime_error("Failed to read QOI header: " + in_file_path);
+	}
+
+	return parse_header(header.data(), in_file_path);
+}
+
+auto qoi_codec::decode(const std::string& in_file_path, size_t in_channels) -> pixel_buffer
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+	const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (data.size() < header_size + end_marker.size())
+	{
+		throw std::runtime_error("Truncated QOI file: " + in_file_path);
+	}
+
+	const auto header	= parse_header(data.data(), in_file_path);
+	const auto channels = in_channels == 0 ? header.channels : in_channels;
+
+	if (channels > 4)
+	{
+		throw std::runtime_error("Unsupported QOI channel count: " + in_file_path);
+	}
+
+	pixel_buffer result{header.width, header.height, channels, {}, {}};
+	result.pixels.resize(static_cast<size_t>(header.width) * static_cast<size_t>(header.height) * channels);
+
+	std::array<pixel, 64> cache{};
+	pixel current{0, 0, 0, 255};
+
+	// The end marker is never part of a chunk, stopping in front of it is the only bounds check the ops need
+	const auto* ptr_in	= data.data() + header_size;
+	const auto* ptr_end = data.data() + data.size() - end_marker.size();
+	auto* ptr_out		= result.pixels.data();
+	auto* ptr_out_end	= ptr_out + result.pixels.size();
+	int32_t run			= 0;
+
+	while (ptr_out < ptr_out_end)
+	{
+		if (run > 0)
+		{
+			--run;
+		}
+		else
+		{
+			if (ptr_in >= ptr_end)
+			{
+				throw std::runtime_error("Truncated QOI data: " + in_file_path);
+			}
+
+			const auto tag = *ptr_in++;
+
+			if (tag == op_rgb || tag == op_rgba)
+			{
+				const auto size = tag == op_rgb ? 3 : 4;
+				if (ptr_end - ptr_in < size)
+				{
+					throw std::runtime_error("Truncated QOI data: " + in_file_path);
+				}
+
+				current.r = ptr_in[0];
+				current.g = ptr_in[1];
+				current.b = ptr_in[2];
+				current.a = tag == op_rgba ? ptr_in[3] : current.a;
+				ptr_in += size;
+			}
+			else if ((tag & op_mask) == op_index)
+			{
+				current = cache[tag];
+			}
+			else if ((tag & op_mask) == op_diff)
+			{
+				current.r = static_cast<uint8_t>(current.r + ((tag >> 4) & 0x03) - 2);
+				current.g = static_cast<uint8_t>(current.g + ((tag >> 2) & 0x03) - 2);
+				current.b = static_cast<uint8_t>(current.b + (tag & 0x03) - 2);
+			}
+			else if ((tag & op_mask) == op_luma)
+			{
+				if (ptr_in >= ptr_end)
+				{
+					throw std::runtime_error("Truncated QOI data: " + in_file_path);
+				}
+
+				const auto diff_green = (tag & 0x3F) - 32;
+				const auto next		  = *ptr_in++;
+
+				current.r = static_cast<uint8_t>(current.r + diff_green - 8 + ((next >> 4) & 0x0F));
+				current.g = static_cast<uint8_t>(current.g + diff_green);
+				current.b = static_cast<uint8_t>(current.b + diff_green - 8 + (next & 0x0F));
+			}
+			else
+			{
+				run = tag & 0x3F;
+			}
+
+			cache[get_hash(current)] = current;
+		}
+
+		switch (channels)
+		{
+		case 1:
+			ptr_out[0] = get_luma(current);
+			break;
+		case 2:
+			ptr_out[0] = get_luma(current);
+			ptr_out[1] = current.a;
+			break;
+		case 3:
+			ptr_out[0] = current.r;
+			ptr_out[1] = current.g;
+			ptr_out[2] = current.b;
+			break;
+		default:
+			ptr_out[0] = current.r;
+			ptr_out[1] = current.g;
+			ptr_out[2] = current.b;
+			ptr_out[3] = current.a;
+			break;
+		}
+
+		ptr_out += channels;
+	}
+
+	return result;
+}
+
+auto qoi_codec::encode(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> std::vector<uint8_t>
+{
+	const auto pixel_count = static_cast<size_t>(in_width) * static_cast<size_t>(in_height);
+	const bool has_alpha   = in_channels == 2 || in_channels == 4;
+
+	std::vector<uint8_t> result;
+	// Worst case every pixel is an RGBA op
+	result.reserve(header_size + pixel_count * 5 + end_marker.size());
+
+	result.insert(result.end(), qoi_magic.begin(), qoi_magic.end());
+	write_u32(result, static_cast<uint32_t>(in_width));
+	write_u32(result, static_cast<uint32_t>(in_height));
+	result.push_back(has_alpha ? 4 : 3);
+	result.push_back(0);
+
+	std::array<pixel, 64> cache{};
+	pixel previous{0, 0, 0, 255};
+	int32_t run = 0;
+
+	for (size_t idx = 0; idx < pixel_count; ++idx)
+	{
+		const auto* ptr_pixel = ptr_pixels + idx * in_channels;
+
+		pixel current{};
+		if (in_channels <= 2)
+		{
+			current = {ptr_pixel[0], ptr_pixel[0], ptr_pixel[0], in_channels == 2 ? ptr_pixel[1] : uint8_t{255}};
+		}
+		else
+		{
+			current = {ptr_pixel[0], ptr_pixel[1], ptr_pixel[2], in_channels == 4 ? ptr_pixel[3] : uint8_t{255}};
+		}
+
+		if (current == previous)
+		{
+			// 62 is the longest run, 63 and 64 would collide with the RGB and RGBA tags
+			if (++run == 62 || idx + 1 == pixel_count)
+			{
+				result.push_back(static_cast<uint8_t>(op_run | (run - 1)));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run > 0)
+		{
+			result.push_back(static_cast<uint8_t>(op_run | (run - 1)));
+			run = 0;
+		}
+
+		const auto hash = get_hash(current);
+
+		if (cache[hash] == current)
+		{
+			result.push_back(static_cast<uint8_t>(op_index | hash));
+		}
+		else if (current.a != previous.a)
+		{
+			result.insert(result.end(), {op_rgba, current.r, current.g, current.b, current.a});
+		}
+		else
+		{
+			const auto diff_r		 = static_cast<int8_t>(current.r - previous.r);
+			const auto diff_g		 = static_cast<int8_t>(current.g - previous.g);
+			const auto diff_b		 = static_cast<int8_t>(current.b - previous.b);
+			const auto diff_r_green = static_cast<int8_t>(diff_r - diff_g);
+			const auto diff_b_green = static_cast<int8_t>(diff_b - diff_g);
+
+			if (diff_r >= -2 && diff_r <= 1 && diff_g >= -2 && diff_g <= 1 && diff_b >= -2 && diff_b <= 1)
+			{
+				result.push_back(static_cast<uint8_t>(op_diff | ((diff_r + 2) << 4) | ((diff_g + 2) << 2) | (diff_b + 2)));
+			}
+			else if (diff_g >= -32 && diff_g <= 31 && diff_r_green >= -8 && diff_r_green <= 7 && diff_b_green >= -8 && diff_b_green <= 7)
+			{
+				result.push_back(static_cast<uint8_t>(op_luma | (diff_g + 32)));
+				result.push_back(static_cast<uint8_t>(((diff_r_green + 8) << 4) | (diff_b_green + 8)));
+			}
+			else
+			{
+				result.insert(result.end(), {op_rgb, current.r, current.g, current.b});
+			}
+		}
+
+		cache[hash] = current;
+		previous	= current;
+	}
+
+	result.insert(result.end(), end_marker.begin(), end_marker.end());
+
+	return result;
+}
@@ -0,0 +1,567 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QUANTIZER_X86 1
+#endif
+
+namespace
+{
+	constexpr size_t kmeans_passes = 2;
+	constexpr size_t radix_buckets = size_t{1} << 11;
+	// Pixels the pre-check looks at, in whole rows spread over the image
+	constexpr size_t probe_samples = size_t{1} << 18;
+	// Below this fraction of the colour entropy in bits per pixel the deflate stream already lives off spatial redundancy a palette cannot add to
+	constexpr double hopeless_ratio = 1.0 / 12.0;
+	// Signature, IHDR, IEND and the PLTE and tRNS chunk framing
+	constexpr size_t palette_overhead = 69;
+
+	auto pack(const rgba& in_color) -> uint32_t
+	{
+		return static_cast<uint32_t>(in_color[0]) | (static_cast<uint32_t>(in_color[1]) << 8) | (static_cast<uint32_t>(in_color[2]) << 16) | (static_cast<uint32_t>(in_color[3]) << 24);
+	}
+
+	auto unpack(uint32_t in_color) -> rgba
+	{
+		return {static_cast<uint8_t>(in_color), static_cast<uint8_t>(in_color >> 8), static_cast<uint8_t>(in_color >> 16), static_cast<uint8_t>(in_color >> 24)};
+	}
+
+	auto get_channel(uint32_t in_color, size_t in_channel) -> uint8_t { return static_cast<uint8_t>(in_color >> (in_channel * 8)); }
+
+	// Any pixel layout read as RGBA, fully transparent pixels lose their colour
+	auto read_pixel(const uint8_t* ptr_pixel, size_t in_channels) -> rgba
+	{
+		rgba color{};
+
+		switch (in_channels)
+		{
+		case 1:
+			color = {ptr_pixel[0], ptr_pixel[0], ptr_pixel[0], 255};
+			break;
+		case 2:
+			color = {ptr_pixel[0], ptr_pixel[0], ptr_pixel[0], ptr_pixel[1]};
+			break;
+		case 3:
+			color = {ptr_pixel[0], ptr_pixel[1], ptr_pixel[2], 255};
+			break;
+		default:
+			color = {ptr_pixel[0], ptr_pixel[1], ptr_pixel[2], ptr_pixel[3]};
+			break;
+		}
+
+		return color[3] == 0 ? rgba{} : color;
+	}
+
+	// Nearest palette entry by squared RGBA distance, ties go to the lowest index
+	class nearest_color
+	{
+	  public:
+		explicit nearest_color(const palette& in_palette) : m_size(in_palette.size())
+		{
+			// Red/green and blue/alpha pairs side by side for _mm_madd_epi16, the padding is far from every colour
+			const auto padded = (m_size + 3) / 4 * 4;
+
+			m_red_green.assign(padded * 2, 1024);
+			m_blue_alpha.assign(padded * 2, 1024);
+
+			for (size_t idx = 0; idx < m_size; ++idx)
+			{
+				m_red_green[idx * 2]	  = in_palette[idx][0];
+				m_red_green[idx * 2 + 1]  = in_palette[idx][1];
+				m_blue_alpha[idx * 2]	  = in_palette[idx][2];
+				m_blue_alpha[idx * 2 + 1] = in_palette[idx][3];
+			}
+		}
+
+		[[nodiscard]] auto find(int32_t in_red, int32_t in_green, int32_t in_blue, int32_t in_alpha) const -> uint8_t
+		{
+#ifdef QUANTIZER_X86
+			const __m128i target_rg = _mm_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(in_green) << 16) | static_cast<uint32_t>(in_red)));
+			const __m128i target_ba = _mm_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(in_alpha) << 16) | static_cast<uint32_t>(in_blue)));
+
+			__m128i best_distance = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+			__m128i best_index	  = _mm_setzero_si128();
+			__m128i index		  = _mm_setr_epi32(0, 1, 2, 3);
+
+			const __m128i step = _mm_set1_epi32(4);
+
+			for (size_t idx = 0; idx < m_red_green.size(); idx += 8)
+			{
+				const __m128i diff_rg = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m_red_green.data() + idx)), target_rg);
+				const __m128i diff_ba = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m_blue_alpha.data() + idx)), target_ba);
+
+				const __m128i distance = _mm_add_epi32(_mm_madd_epi16(diff_rg, diff_rg), _mm_madd_epi16(diff_ba, diff_ba));
+				const __m128i closer   = _mm_cmplt_epi32(distance, best_distance);
+
+				best_distance = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best_distance));
+				best_index	  = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, best_index));
+				index		  = _mm_add_epi32(index, step);
+			}
+
+			alignas(16) std::array<int32_t, 4> distances{};
+			alignas(16) std::array<int32_t, 4> indices{};
+			_mm_store_si128(reinterpret_cast<__m128i*>(distances.data()), best_distance);
+			_mm_store_si128(reinterpret_cast<__m128i*>(indices.data()), best_index);
+
+			size_t best = 0;
+			for (size_t lane = 1; lane < 4; ++lane)
+			{
+				if (distances[lane] < distances[best] || (distances[lane] == distances[best] && indices[lane] < indices[best]))
+				{
+					best = lane;
+				}
+			}
+
+			return static_cast<uint8_t>(indices[best]);
+#else
+			int32_t best_distance = std::numeric_limits<int32_t>::max();
+			size_t best_index	  = 0;
+
+			for (size_t idx = 0; idx < m_size; ++idx)
+			{
+				const int32_t diff_red	 = m_red_green[idx * 2] - in_red;
+				const int32_t diff_green = m_red_green[idx * 2 + 1] - in_green;
+				const int32_t diff_blue	 = m_blue_alpha[idx * 2] - in_blue;
+				const int32_t diff_alpha = m_blue_alpha[idx * 2 + 1] - in_alpha;
+
+				const int32_t distance = diff_red * diff_red + diff_green * diff_green + diff_blue * diff_blue + diff_alpha * diff_alpha;
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index	  = idx;
+				}
+			}
+
+			return static_cast<uint8_t>(best_index);
+#endif
+		}
+
+	  private:
+		size_t m_size;
+		std::vector<int16_t> m_red_green;
+		std::vector<int16_t> m_blue_alpha;
+	};
+
+	// Appends one entry per run of equal pixels in the row, SSE2 compares four RGBA pixels with their left neighbours at once
+	auto fold_runs(const uint8_t* ptr_row, size_t in_width, size_t in_channels, std::vector<color_count>& out_runs) -> void
+	{
+		size_t pos_x = 0;
+
+#ifdef QUANTIZER_X86
+		if (in_channels == 4)
+		{
+			const auto* ptr_pixels = reinterpret_cast<const uint32_t*>(ptr_row);
+			out_runs.push_back({pack(read_pixel(ptr_row, 4)), 1});
+
+			pos_x = 1;
+			for (; pos_x + 4 <= in_width; pos_x += 4)
+			{
+				const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_pixels + pos_x));
+				const __m128i left	  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_pixels + pos_x - 1));
+
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(current, left)) == 0xFFFF)
+				{
+					out_runs.back().count += 4;
+					continue;
+				}
+
+				for (size_t idx = pos_x; idx < pos_x + 4; ++idx)
+				{
+					if (std::memcmp(ptr_row + idx * 4, ptr_row + (idx - 1) * 4, 4) == 0)
+					{
+						++out_runs.back().count;
+					}
+					else
+					{
+						out_runs.push_back({pack(read_pixel(ptr_row + idx * 4, 4)), 1});
+					}
+				}
+			}
+		}
+#endif
+
+		for (; pos_x < in_width; ++pos_x)
+		{
+			const auto color = pack(read_pixel(ptr_row + pos_x * in_channels, in_channels));
+
+			if (pos_x > 0 && out_runs.back().color == color)
+			{
+				++out_runs.back().count;
+			}
+			else
+			{
+				out_runs.push_back({color, 1});
+			}
+		}
+	}
+
+	// Range of histogram entries that end up in one palette colour
+	struct box
+	{
+		size_t begin;
+		size_t end;
+		uint64_t weight;
+		size_t channel;
+		uint32_t range;
+	};
+
+	auto make_box(const std::vector<color_count>& in_histogram, size_t in_begin, size_t in_end) -> box
+	{
+		std::array<uint8_t, 4> low{255, 255, 255, 255};
+		std::array<uint8_t, 4> high{};
+		uint64_t weight = 0;
+
+		for (size_t idx = in_begin; idx < in_end; ++idx)
+		{
+			for (size_t channel = 0; channel < 4; ++channel)
+			{
+				low[channel]  = std::min(low[channel], get_channel(in_histogram[idx].color, channel));
+				high[channel] = std::max(high[channel], get_channel(in_histogram[idx].color, channel));
+			}
+
+			weight += in_histogram[idx].count;
+		}
+
+		box result{in_begin, in_end, weight, 0, 0};
+		for (size_t channel = 0; channel < 4; ++channel)
+		{
+			const auto range = static_cast<uint32_t>(high[channel] - low[channel]);
+			if (range > result.range)
+			{
+				result.range   = range;
+				result.channel = channel;
+			}
+		}
+
+		return result;
+	}
+} // namespace
+
+quantizer::quantizer(size_t in_max_colors, bool in_dither) : m_max_colors(std::clamp<size_t>(in_max_colors, 2, 256)), m_dither(in_dither) {}
+
+auto quantizer::build_histogram(const uint8_t* ptr_pixels, size_t in_pixel_count, size_t in_channels, size_t in_step) -> std::vector<color_count>
+{
+	in_step = std::max<size_t>(in_step, 1);
+
+	std::vector<uint32_t> colors((in_pixel_count + in_step - 1) / in_step);
+	for (size_t idx = 0; idx < colors.size(); ++idx)
+	{
+		colors[idx] = pack(read_pixel(ptr_pixels + idx * in_step * in_channels, in_channels));
+	}
+
+	// LSD radix sort in three passes of at most 11 bits, several times faster than a comparison sort on megapixel images
+	std::vector<uint32_t> scratch(colors.size());
+
+	for (const uint32_t shift : {0U, 11U, 22U})
+	{
+		std::array<size_t, radix_buckets + 1> offsets{};
+		for (const auto color : colors)
+		{
+			++offsets[((color >> shift) & (radix_buckets - 1)) + 1];
+		}
+
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+		for (const auto color : colors)
+		{
+			scratch[offsets[(color >> shift) & (radix_buckets - 1)]++] = color;
+		}
+
+		colors.swap(scratch);
+	}
+
+	std::vector<color_count> histogram;
+	for (const auto color : colors)
+	{
+		if (histogram.empty() || histogram.back().color != color)
+		{
+			histogram.push_back({color, 0});
+		}
+
+		++histogram.back().count;
+	}
+
+	return histogram;
+}
+
+auto quantizer::probe(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels) -> color_probe
+{
+	const auto width	   = static_cast<size_t>(in_width);
+	const auto height	   = static_cast<size_t>(in_height);
+	const auto row_step	   = std::max<size_t>(width * height / probe_samples, 1);
+	const auto stride	   = width * in_channels;
+
+	std::vector<color_count> runs;
+	size_t samples = 0;
+
+	for (size_t pos_y = 0; pos_y < height; pos_y += row_step)
+	{
+		fold_runs(ptr_pixels + pos_y * stride, width, in_channels, runs);
+		samples += width;
+	}
+
+	const auto histogram = merge_histograms({runs});
+
+	double entropy = 0.0;
+	for (const auto& entry : histogram)
+	{
+		const auto probability = static_cast<double>(entry.count) / static_cast<double>(samples);
+		entropy -= probability * std::log2(probability);
+	}
+
+	return {histogram.size(), entropy};
+}
+
+auto quantizer::classify(const color_probe& in_probe, bool in_is_paletted, size_t in_encoded_size, size_t in_pixel_count) -> compress_class
+{
+	if (in_is_paletted)
+	{
+		return compress_class::paletted;
+	}
+
+	// PLTE and tRNS alone would take up the whole file
+	const auto palette_colors = std::min<size_t>(in_probe.unique_colors, 256);
+	if (in_encoded_size <= palette_overhead + palette_colors * 4)
+	{
+		return compress_class::skip;
+	}
+
+	// Every colour fits, the indexed file is lossless and one byte per pixel
+	if (in_probe.unique_colors <= 256)
+	{
+		return compress_class::beneficial;
+	}
+
+	const auto encoded_bpp = static_cast<double>(in_encoded_size) * 8.0 / static_cast<double>(std::max<size_t>(in_pixel_count, 1));
+	return encoded_bpp < std::min(in_probe.entropy, 8.0) * hopeless_ratio ? compress_class::skip : compress_class::beneficial;
+}
+
+auto quantizer::merge_histograms(const std::vector<std::vector<color_count>>& in_histograms) -> std::vector<color_count>
+{
+	std::vector<color_count> merged;
+	for (const auto& histogram : in_histograms)
+	{
+		merged.insert(merged.end(), histogram.begin(), histogram.end());
+	}
+
+	std::sort(merged.begin(), merged.end(), [](const color_count& lhs, const color_count& rhs) { return lhs.color < rhs.color; });
+
+	// Counts saturate instead of wrapping, only their proportions matter to the median cut
+	size_t count = 0;
+	for (const auto& entry : merged)
+	{
+		if (count > 0 && merged[count - 1].color == entry.color)
+		{
+			merged[count - 1].count = static_cast<uint32_t>(std::min<uint64_t>(uint64_t{merged[count - 1].count} + entry.count, std::numeric_limits<uint32_t>::max()));
+			continue;
+		}
+
+		merged[count++] = entry;
+	}
+
+	merged.resize(count);
+
+	return merged;
+}
+
+auto quantizer::build_palette(std::vector<color_count> in_histogram) const -> palette
+{
+	palette colors;
+
+	if (in_histogram.size() <= m_max_colors)
+	{
+		// Few enough colours to keep every one of them, the result is lossless
+		std::transform(in_histogram.begin(), in_histogram.end(), std::back_inserter(colors), [](const color_count& entry) { return unpack(entry.color); });
+	}
+	else
+	{
+		std::vector<box> boxes{make_box(in_histogram, 0, in_histogram.size())};
+
+		// Split the box with the widest channel range, weighted by how many pixels it covers, at its weighted median
+		while (boxes.size() < m_max_colors)
+		{
+			auto target = std::max_element(boxes.begin(), boxes.end(),
+										   [](const box& lhs, const box& rhs) { return static_cast<double>(lhs.range) * static_cast<double>(lhs.weight) < static_cast<double>(rhs.range) * static_cast<double>(rhs.weight); });
+
+			if (target->range == 0)
+			{
+				break;
+			}
+
+			const auto current = *target;
+			std::sort(in_histogram.begin() + static_cast<ptrdiff_t>(current.begin), in_histogram.begin() + static_cast<ptrdiff_t>(current.end),
+					  [channel = current.channel](const color_count& lhs, const color_count& rhs) { return get_channel(lhs.color, channel) < get_channel(rhs.color, channel); });
+
+			size_t split	  = current.begin + 1;
+			uint64_t weight	  = in_histogram[current.begin].count;
+			while (split + 1 < current.end && weight * 2 < current.weight)
+			{
+				weight += in_histogram[split].count;
+				++split;
+			}
+
+			*target = make_box(in_histogram, current.begin, split);
+			boxes.push_back(make_box(in_histogram, split, current.end));
+		}
+
+		for (const auto& current : boxes)
+		{
+			std::array<uint64_t, 4> sums{};
+			for (size_t idx = current.begin; idx < current.end; ++idx)
+			{
+				for (size_t channel = 0; channel < 4; ++channel)
+				{
+					sums[channel] += static_cast<uint64_t>(get_channel(in_histogram[idx].color, channel)) * in_histogram[idx].count;
+				}
+			}
+
+			rgba color{};
+			for (size_t channel = 0; channel < 4; ++channel)
+			{
+				color[channel] = static_cast<uint8_t>((sums[channel] + current.weight / 2) / current.weight);
+			}
+
+			colors.push_back(color);
+		}
+
+		// A few Lloyd passes over the histogram pull each entry to the mean of the colours that map to it
+		for (size_t pass = 0; pass < kmeans_passes; ++pass)
+		{
+			const nearest_color search(colors);
+
+			std::vector<std::array<uint64_t, 4>> sums(colors.size(), std::array<uint64_t, 4>{});
+			std::vector<uint64_t> weights(colors.size(), 0);
+
+			for (const auto& entry : in_histogram)
+			{
+				const auto color = unpack(entry.color);
+				const auto index = search.find(color[0], color[1], color[2], color[3]);
+
+				for (size_t channel = 0; channel < 4; ++channel)
+				{
+					sums[index][channel] += static_cast<uint64_t>(color[channel]) * entry.count;
+				}
+
+				weights[index] += entry.count;
+			}
+
+			for (size_t idx = 0; idx < colors.size(); ++idx)
+			{
+				if (weights[idx] == 0)
+				{
+					continue;
+				}
+
+				for (size_t channel = 0; channel < 4; ++channel)
+				{
+					colors[idx][channel] = static_cast<uint8_t>((sums[idx][channel] + weights[idx] / 2) / weights[idx]);
+				}
+			}
+		}
+	}
+
+	std::stable_sort(colors.begin(), colors.end(), [](const rgba& lhs, const rgba& rhs) { return lhs[3] < rhs[3]; });
+
+	return colors;
+}
+
+auto quantizer::remap(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, const palette& in_palette) const -> std::vector<uint8_t>
+{
+	const auto width		= static_cast<size_t>(in_width);
+	const auto pixel_count = width * static_cast<size_t>(in_height);
+
+	const nearest_color search(in_palette);
+	std::vector<uint8_t> indices(pixel_count);
+
+	// Palette entries sorted by packed colour, exact matches skip the search and never carry dither error
+	std::vector<std::pair<uint32_t, uint8_t>> exact;
+	for (size_t idx = 0; idx < in_palette.size(); ++idx)
+	{
+		exact.emplace_back(pack(in_palette[idx]), static_cast<uint8_t>(idx));
+	}
+
+	std::sort(exact.begin(), exact.end());
+
+	auto find_exact = [&exact](uint32_t in_color) -> int32_t
+	{
+		const auto found = std::lower_bound(exact.begin(), exact.end(), std::make_pair(in_color, uint8_t{0}));
+		return found != exact.end() && found->first == in_color ? found->second : -1;
+	};
+
+	if (!m_dither)
+	{
+		// Neighbouring pixels often share a colour, the last lookup is reused
+		uint32_t last_color = ~uint32_t{0};
+		uint8_t last_index	= 0;
+
+		for (size_t idx = 0; idx < pixel_count; ++idx)
+		{
+			const auto color  = read_pixel(ptr_pixels + idx * in_channels, in_channels);
+			const auto packed = pack(color);
+
+			if (packed != last_color)
+			{
+				const auto index = find_exact(packed);
+
+				last_color = packed;
+				last_index = index >= 0 ? static_cast<uint8_t>(index) : search.find(color[0], color[1], color[2], color[3]);
+			}
+
+			indices[idx] = last_index;
+		}
+
+		return indices;
+	}
+
+	// Floyd-Steinberg, error for the current and the next row with one pixel of padding on each side
+	std::vector<std::array<float, 4>> error_row((width + 2), std::array<float, 4>{});
+	std::vector<std::array<float, 4>> error_next((width + 2), std::array<float, 4>{});
+
+	for (size_t pos_y = 0; pos_y < static_cast<size_t>(in_height); ++pos_y)
+	{
+		std::fill(error_next.begin(), error_next.end(), std::array<float, 4>{});
+
+		for (size_t pos_x = 0; pos_x < width; ++pos_x)
+		{
+			const auto idx	 = pos_y * width + pos_x;
+			const auto color = read_pixel(ptr_pixels + idx * in_channels, in_channels);
+
+			// Transparent pixels stay transparent and do not spread error into the sprite edges
+			if (color[3] == 0)
+			{
+				const auto index = find_exact(0);
+				indices[idx]	 = index >= 0 ? static_cast<uint8_t>(index) : search.find(0, 0, 0, 0);
+				continue;
+			}
+
+			std::array<int32_t, 4> target{};
+			for (size_t channel = 0; channel < 4; ++channel)
+			{
+				target[channel] = std::clamp(static_cast<int32_t>(std::lround(static_cast<float>(color[channel]) + error_row[pos_x + 1][channel])), 0, 255);
+			}
+
+			const auto index = search.find(target[0], target[1], target[2], target[3]);
+			indices[idx]	 = index;
+
+			for (size_t channel = 0; channel < 4; ++channel)
+			{
+				const auto error = static_cast<float>(target[channel] - in_palette[index][channel]);
+
+				error_row[pos_x + 2][channel] += error * 7.0F / 16.0F;
+				error_next[pos_x][channel] += error * 3.0F / 16.0F;
+				error_next[pos_x + 1][channel] += error * 5.0F / 16.0F;
+				error_next[pos_x + 2][channel] += error * 1.0F / 16.0F;
+			}
+		}
+
+		error_row.swap(error_next);
+	}
+
+	return indices;
+}
@@ -0,0 +1,199 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+	thread_local const thread_pool* t_pool = nullptr;
+	thread_local size_t t_worker_index	   = 0;
+} // namespace
+
+thread_pool::thread_pool(size_t in_num_threads)
+{
+	const auto num_threads = std::max<size_t>(in_num_threads, 1);
+
+	for (size_t idx = 0; idx < num_threads; ++idx)
+	{
+		m_queues.push_back(std::make_unique<queue>());
+	}
+
+	for (size_t idx = 0; idx < num_threads; ++idx)
+	{
+		m_threads.emplace_back([this, idx]() { worker_loop(idx); });
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		m_stop = true;
+	}
+
+	m_sleep_condition.notify_all();
+
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+auto thread_pool::get_worker_index() const -> size_t { return t_pool == this ? t_worker_index : m_threads.size(); }
+
+auto thread_pool::run(std::vector<task> in_tasks, memory_budget* ptr_budget) -> void
+{
+	if (in_tasks.empty())
+	{
+		return;
+	}
+
+	batch current;
+	current.remaining = in_tasks.size();
+
+	// Largest first, each task goes to the queue with the least cost queued so far
+	std::stable_sort(in_tasks.begin(), in_tasks.end(), [](const task& lhs, const task& rhs) { return lhs.cost > rhs.cost; });
+
+	for (auto& entry : in_tasks)
+	{
+		// Blocks until the running tasks give enough back, the workers stay free to finish them
+		if (ptr_budget != nullptr)
+		{
+			ptr_budget->acquire(entry.admit_bytes);
+		}
+
+		auto target = std::min_element(m_queues.begin(), m_queues.end(), [](const auto& lhs, const auto& rhs) { return lhs->queued_cost.load() < rhs->queued_cost.load(); });
+
+		{
+			std::lock_guard<std::mutex> lock((*target)->mutex);
+
+			// Counted before the job is visible, a worker that takes it straight away must not wrap the count below zero
+			++m_pending;
+			(*target)->jobs.push_back({entry.cost, std::move(entry.work), &current});
+			(*target)->queued_cost += entry.cost;
+		}
+
+		{
+			// A worker between checking m_pending and going to sleep holds this lock, so it cannot miss the notify
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		}
+
+		m_sleep_condition.notify_all();
+	}
+
+	// Help with the tasks of this batch instead of idling. Jobs of other batches are left alone, an outer sibling picked up here
+	// would nest without bound and could block on a memory budget that only this batch's tasks can give back.
+	const auto own_index = get_worker_index() % m_queues.size();
+
+	while (current.remaining > 0)
+	{
+		job next;
+		if (try_pop(own_index, next, &current))
+		{
+			execute(next);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(current.mutex);
+		current.condition.wait(lock, [&current]() { return current.remaining == 0; });
+	}
+
+	// Taking the lock once more makes sure the last task let go of the batch before it leaves the stack
+	std::lock_guard<std::mutex> lock(current.mutex);
+
+	if (current.error)
+	{
+		std::rethrow_exception(current.error);
+	}
+}
+
+auto thread_pool::worker_loop(size_t in_index) -> void
+{
+	t_pool		   = this;
+	t_worker_index = in_index;
+
+	while (true)
+	{
+		job next;
+		if (try_pop(in_index, next))
+		{
+			execute(next);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_sleep_condition.wait(lock, [this]() { return m_stop || m_pending > 0; });
+
+		if (m_stop && m_pending == 0)
+		{
+			return;
+		}
+	}
+}
+
+auto thread_pool::try_pop(size_t in_index, job& out_job, const batch* ptr_only) -> bool
+{
+	auto matches = [ptr_only](const job& in_job) { return ptr_only == nullptr || in_job.ptr_batch == ptr_only; };
+
+	auto take = [this, &out_job](queue& in_queue, std::deque<job>::iterator in_it)
+	{
+		out_job = std::move(*in_it);
+		in_queue.jobs.erase(in_it);
+		in_queue.queued_cost -= out_job.cost;
+		--m_pending;
+	};
+
+	// Own queue from the front, the largest task left
+	{
+		auto& own = *m_queues[in_index];
+
+		std::lock_guard<std::mutex> lock(own.mutex);
+		const auto found = std::find_if(own.jobs.begin(), own.jobs.end(), matches);
+		if (found != own.jobs.end())
+		{
+			take(own, found);
+			return true;
+		}
+	}
+
+	// Steal from the back of the others
+	for (size_t offset = 1; offset < m_queues.size(); ++offset)
+	{
+		auto& victim = *m_queues[(in_index + offset) % m_queues.size()];
+
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		const auto found = std::find_if(victim.jobs.rbegin(), victim.jobs.rend(), matches);
+		if (found != victim.jobs.rend())
+		{
+			take(victim, std::next(found).base());
+			return true;
+		}
+	}
+
+	return false;
+}
+
+auto thread_pool::execute(job& in_job) -> void
+{
+	auto* ptr_batch = in_job.ptr_batch;
+
+	try
+	{
+		in_job.work();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(ptr_batch->mutex);
+		if (!ptr_batch->error)
+		{
+			ptr_batch->error = std::current_exception();
+		}
+	}
+
+	// The batch lives on the stack of the waiting thread, it may be gone as soon as remaining hits 0 outside the lock
+	std::lock_guard<std::mutex> lock(ptr_batch->mutex);
+	if (--ptr_batch->remaining == 0)
+	{
+		ptr_batch->condition.notify_all();
+	}
+}
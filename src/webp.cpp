@@ -0,0 +1,201 @@
+#include "webp.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// The build defines it when it finds both the headers and the library, the header check only covers builds that do not
+#ifndef TRIMMER_HAS_WEBP
+#if __has_include(<webp/decode.h>) && __has_include(<webp/encode.h>)
+#define TRIMMER_HAS_WEBP 1
+#else
+#define TRIMMER_HAS_WEBP 0
+#endif
+#endif
+
+#if TRIMMER_HAS_WEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+namespace
+{
+	std::atomic<int32_t> lossy_quality{90};
+
+#if TRIMMER_HAS_WEBP
+	// The features sit in the first chunks, a few hundred bytes are always enough
+	auto read_head(const std::string& in_file_path) -> std::vector<uint8_t>
+	{
+		std::ifstream file(in_file_path, std::ios::binary);
+		std::vector<uint8_t> data(1024);
+		file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		data.resize(static_cast<size_t>(file.gcount()));
+
+		return data;
+	}
+
+	auto read_file(const std::string& in_file_path) -> std::vector<uint8_t>
+	{
+		std::ifstream file(in_file_path, std::ios::binary);
+		if (!file)
+		{
+			throw std::runtime_error("Failed to open WebP: " + in_file_path);
+		}
+
+		return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	}
+
+	auto get_features(const std::vector<uint8_t>& in_data, const std::string& in_file_path) -> WebPBitstreamFeatures
+	{
+		WebPBitstreamFeatures features{};
+		if (WebPGetFeatures(in_data.data(), in_data.size(), &features) != VP8_STATUS_OK)
+		{
+			throw std::runtime_error("Invalid WebP header: " + in_file_path);
+		}
+
+		return features;
+	}
+
+	// Widens grey to RGB so libwebp gets the layout it takes
+	auto widen_grey(const uint8_t* ptr_pixels, size_t in_pixel_count, bool in_has_alpha) -> std::vector<uint8_t>
+	{
+		const size_t channels = in_has_alpha ? 4 : 3;
+		std::vector<uint8_t> result(in_pixel_count * channels);
+
+		for (size_t idx = 0; idx < in_pixel_count; ++idx)
+		{
+			const auto* ptr_src = ptr_pixels + idx * (in_has_alpha ? 2 : 1);
+			auto* ptr_dst		= result.data() + idx * channels;
+
+			ptr_dst[0] = ptr_src[0];
+			ptr_dst[1] = ptr_src[0];
+			ptr_dst[2] = ptr_src[0];
+			if (in_has_alpha)
+			{
+				ptr_dst[3] = ptr_src[1];
+			}
+		}
+
+		return result;
+	}
+#else
+	[[noreturn]] auto throw_unavailable(const std::string& in_context) -> void { throw std::runtime_error("Built without libwebp: " + in_context); }
+#endif
+} // namespace
+
+auto webp_codec::is_available() -> bool { return TRIMMER_HAS_WEBP != 0; }
+
+auto webp_codec::can_read(const std::string& in_file_path) -> bool
+{
+	std::ifstream file(in_file_path, std::ios::binary);
+
+	std::array<char, 12> header{};
+	file.read(header.data(), header.size());
+
+	return file && std::memcmp(header.data(), "RIFF", 4) == 0 && std::memcmp(header.data() + 8, "WEBP", 4) == 0;
+}
+
+auto webp_codec::read_header(const std::string& in_file_path) -> image_header
+{
+#if TRIMMER_HAS_WEBP
+	const auto features = get_features(read_head(in_file_path), in_file_path);
+	return {features.width, features.height, features.has_alpha != 0 ? size_t{4} : size_t{3}};
+#else
+	throw_unavailable(in_file_path);
+#endif
+}
+
+auto webp_codec::is_lossy(const std::string& in_file_path) -> bool
+{
+#if TRIMMER_HAS_WEBP
+	// Format 0 is an animation mixing both, treated as lossy so nothing in it grows
+	return get_features(read_head(in_file_path), in_file_path).format != 2;
+#else
+	throw_unavailable(in_file_path);
+#endif
+}
+
+auto webp_codec::set_quality(int32_t in_quality) -> void { lossy_quality = in_quality; }
+
+auto webp_codec::decode(const std::string& in_file_path, size_t in_channels) -> pixel_buffer
+{
+#if TRIMMER_HAS_WEBP
+	const auto data		= read_file(in_file_path);
+	const auto features = get_features(data, in_file_path);
+	const auto channels = in_channels == 0 ? (features.has_alpha != 0 ? size_t{4} : size_t{3}) : in_channels;
+
+	if (channels != 3 && channels != 4)
+	{
+		throw std::runtime_error("Unsupported WebP channel count: " + in_file_path);
+	}
+
+	pixel_buffer result{features.width, features.height, channels, {}, {}};
+	result.pixels.resize(static_cast<size_t>(features.width) * static_cast<size_t>(features.height) * channels);
+
+	const auto stride = static_cast<int32_t>(static_cast<size_t>(features.width) * channels);
+	const auto* ptr_decoded = channels == 4 ? WebPDecodeRGBAInto(data.data(), data.size(), result.pixels.data(), result.pixels.size(), stride)
+											: WebPDecodeRGBInto(data.data(), data.size(), result.pixels.data(), result.pixels.size(), stride);
+
+	if (ptr_decoded == nullptr)
+	{
+		throw std::runtime_error("Failed to decode WebP: " + in_file_path);
+	}
+
+	return result;
+#else
+	(void)in_channels;
+	throw_unavailable(in_file_path);
+#endif
+}
+
+auto webp_codec::encode(const uint8_t* ptr_pixels, int32_t in_width, int32_t in_height, size_t in_channels, bool in_lossy) -> std::vector<uint8_t>
+{
+#if TRIMMER_HAS_WEBP
+	const auto pixel_count = static_cast<size_t>(in_width) * static_cast<size_t>(in_height);
+	const bool has_alpha   = in_channels == 2 || in_channels == 4;
+
+	std::vector<uint8_t> widened;
+	if (in_channels <= 2)
+	{
+		widened	   = widen_grey(ptr_pixels, pixel_count, has_alpha);
+		ptr_pixels = widened.data();
+	}
+
+	const auto stride = in_width * (has_alpha ? 4 : 3);
+
+	const auto quality = static_cast<float>(lossy_quality.load());
+
+	uint8_t* ptr_output = nullptr;
+	size_t size			= 0;
+
+	if (in_lossy)
+	{
+		size = has_alpha ? WebPEncodeRGBA(ptr_pixels, in_width, in_height, stride, quality, &ptr_output) : WebPEncodeRGB(ptr_pixels, in_width, in_height, stride, quality, &ptr_output);
+	}
+	else
+	{
+		size = has_alpha ? WebPEncodeLosslessRGBA(ptr_pixels, in_width, in_height, stride, &ptr_output) : WebPEncodeLosslessRGB(ptr_pixels, in_width, in_height, stride, &ptr_output);
+	}
+
+	if (size == 0)
+	{
+		WebPFree(ptr_output);
+		throw std::runtime_error("Failed to encode WebP");
+	}
+
+	std::vector<uint8_t> result(ptr_output, ptr_output + size);
+	WebPFree(ptr_output);
+
+	return result;
+#else
+	(void)ptr_pixels;
+	(void)in_width;
+	(void)in_height;
+	(void)in_channels;
+	(void)in_lossy;
+	throw_unavailable("WebP encode");
+#endif
+}
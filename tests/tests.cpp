@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+#include "alpha_scan.hpp"
+#include "decoder.hpp"
+#include "image.hpp"
+#include "png.hpp"
+#include "png_writer.hpp"
+#include "quantizer.hpp"
+#include "thread_pool.hpp"
+
+// One runner for every case, CTest starts it once per case name so a failure points at the case
+namespace
+{
+	constexpr uint32_t seed = 0x5eed;
+
+	auto expect(bool in_condition, const std::string& in_message) -> void
+	{
+		if (!in_condition)
+		{
+			throw std::runtime_error(in_message);
+		}
+	}
+
+	// Fresh directory for the fixtures of one case, removed with everything in it when the case ends
+	class scratch_dir
+	{
+	  public:
+		explicit scratch_dir(const std::string& in_name)
+			: m_path(std::filesystem::temp_directory_path() / std::format("image_trimmer_{}_{}", in_name, getpid()))
+		{
+			std::filesystem::remove_all(m_path);
+			std::filesystem::create_directories(m_path);
+		}
+
+		~scratch_dir()
+		{
+			std::error_code error;
+			std::filesystem::remove_all(m_path, error);
+		}
+
+		scratch_dir(const scratch_dir&)					   = delete;
+		scratch_dir(scratch_dir&&)						   = delete;
+		auto operator=(const scratch_dir&) -> scratch_dir& = delete;
+
+		[[nodiscard]] auto get_file(const std::string& in_name) const -> std::string { return (m_path / in_name).string(); }
+
+	  private:
+		std::filesystem::path m_path;
+	};
+
+	auto to_string(const rect& in_rect) -> std::string { return std::format("{}x{} at {},{}", in_rect.get_width(), in_rect.get_height(), in_rect.get_x(), in_rect.get_y()); }
+
+	// Empty rects compare equal whatever their origin
+	auto is_same_rect(const rect& in_lhs, const rect& in_rhs) -> bool
+	{
+		if (in_lhs.get_area() <= 0 || in_rhs.get_area() <= 0)
+		{
+			return in_lhs.get_area() <= 0 && in_rhs.get_area() <= 0;
+		}
+
+		return in_lhs.get_x() == in_rhs.get_x() && in_lhs.get_y() == in_rhs.get_y() && in_lhs.get_width() == in_rhs.get_width() && in_lhs.get_height() == in_rhs.get_height();
+	}
+
+	// Runs both searches of in_kernel on one row and compares them with the scalar kernel
+	auto check_row(const alpha_scan::kernel& in_kernel, const uint8_t* ptr_pixels, int32_t in_count, size_t in_stride, uint8_t in_threshold) -> void
+	{
+		const auto reference = alpha_scan::get_scalar_kernel();
+		const bool is_plane	 = in_stride == 1;
+
+		const int32_t expected_first = is_plane ? reference.plane_first(ptr_pixels, in_count, in_threshold) : reference.first(ptr_pixels, in_count, in_threshold);
+		const int32_t expected_last	 = is_plane ? reference.plane_last(ptr_pixels, in_count, in_threshold) : reference.last(ptr_pixels, in_count, in_threshold);
+		const int32_t found_first	 = is_plane ? in_kernel.plane_first(ptr_pixels, in_count, in_threshold) : in_kernel.first(ptr_pixels, in_count, in_threshold);
+		const int32_t found_last	 = is_plane ? in_kernel.plane_last(ptr_pixels, in_count, in_threshold) : in_kernel.last(ptr_pixels, in_count, in_threshold);
+
+		expect(found_first == expected_first && found_last == expected_last,
+			   std::format("{} {} kernel found {}..{} on {} pixels above {}, the scalar one {}..{}", in_kernel.name, is_plane ? "plane" : "RGBA", found_first, found_last, in_count,
+						   in_threshold, expected_first, expected_last));
+	}
+
+	// Every kernel this machine runs against the scalar one, on every row length up to a few blocks of the widest and at every threshold edge
+	auto test_alpha_scan() -> void
+	{
+		constexpr int32_t max_count	 = 130;
+		constexpr int32_t noise_rows = 4;
+		constexpr int32_t max_alpha	 = 255;
+
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int32_t> byte_dist(0, max_alpha);
+
+		for (const auto& entry : alpha_scan::get_supported_kernels())
+		{
+			spdlog::info("Checking the {} kernel", entry.name);
+
+			// Interleaved RGBA with alpha last, then an alpha plane
+			for (const auto& [stride, offset] : std::array<std::pair<size_t, size_t>, 2>{{{4, 3}, {1, 0}}})
+			{
+				for (int32_t count = 0; count <= max_count; ++count)
+				{
+					// The row ends the buffer so a read past it stands out under a sanitizer, every other length starts unaligned
+					const auto lead = static_cast<size_t>(count & 1);
+					std::vector<uint8_t> buffer(lead + static_cast<size_t>(count) * stride);
+					uint8_t* ptr_row = buffer.data() + lead;
+
+					auto alpha_at = [&](int32_t in_x) -> uint8_t& { return ptr_row[static_cast<size_t>(in_x) * stride + offset]; };
+					auto fill_noise = [&]() { std::generate(buffer.begin(), buffer.end(), [&]() { return static_cast<uint8_t>(byte_dist(generator)); }); };
+
+					// One pixel above a flat background at every position, thresholds on both sides of both values
+					for (int32_t hot_x = 0; hot_x < count; ++hot_x)
+					{
+						fill_noise();
+
+						const int32_t hot		 = std::max(byte_dist(generator), 1);
+						const int32_t background = byte_dist(generator) % hot;
+
+						for (int32_t pos_x = 0; pos_x < count; ++pos_x)
+						{
+							alpha_at(pos_x) = static_cast<uint8_t>(background);
+						}
+						alpha_at(hot_x) = static_cast<uint8_t>(hot);
+
+						for (const int32_t threshold : {0, background - 1, background, hot - 1, hot, max_alpha - 1, max_alpha})
+						{
+							if (threshold >= 0)
+							{
+								check_row(entry, ptr_row, count, stride, static_cast<uint8_t>(threshold));
+							}
+						}
+					}
+
+					// Noise rows against every threshold
+					for (int32_t row = 0; row < noise_rows; ++row)
+					{
+						fill_noise();
+
+						for (int32_t threshold = 0; threshold <= max_alpha; ++threshold)
+						{
+							check_row(entry, ptr_row, count, stride, static_cast<uint8_t>(threshold));
+						}
+					}
+				}
+			}
+		}
+	}
+
+	struct fixture
+	{
+		std::string name;
+		int32_t width;
+		int32_t height;
+		size_t channels;
+		std::vector<uint8_t> pixels;
+		// Flood fill only follows the component of the first opaque pixel, it can only agree on fixtures with a single one
+		bool is_connected;
+	};
+
+	// Any alpha above 0 counts, like the scanners with their default threshold
+	auto get_expected_boundings(const fixture& in_fixture) -> rect
+	{
+		if (in_fixture.channels != 2 && in_fixture.channels != 4)
+		{
+			return {0, 0, in_fixture.width, in_fixture.height};
+		}
+
+		rect boundings;
+		for (int32_t pos_y = 0; pos_y < in_fixture.height; ++pos_y)
+		{
+			for (int32_t pos_x = 0; pos_x < in_fixture.width; ++pos_x)
+			{
+				const auto pixel = static_cast<size_t>(pos_y) * static_cast<size_t>(in_fixture.width) + static_cast<size_t>(pos_x);
+				if (in_fixture.pixels[pixel * in_fixture.channels + in_fixture.channels - 1] > 0)
+				{
+					boundings = boundings.get_union({pos_x, pos_y, pos_x + 1, pos_y + 1});
+				}
+			}
+		}
+
+		return boundings;
+	}
+
+	auto make_fixtures() -> std::vector<fixture>
+	{
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int32_t> byte_dist(1, 255);
+
+		std::vector<fixture> fixtures;
+
+		auto add_fixture = [&](const std::string& in_name, int32_t in_width, int32_t in_height, size_t in_channels, bool in_is_connected, auto in_is_opaque)
+		{
+			fixture entry{in_name, in_width, in_height, in_channels, std::vector<uint8_t>(static_cast<size_t>(in_width) * static_cast<size_t>(in_height) * in_channels), in_is_connected};
+
+			for (int32_t pos_y = 0; pos_y < in_height; ++pos_y)
+			{
+				for (int32_t pos_x = 0; pos_x < in_width; ++pos_x)
+				{
+					uint8_t* ptr_pixel = entry.pixels.data() + (static_cast<size_t>(pos_y) * static_cast<size_t>(in_width) + static_cast<size_t>(pos_x)) * in_channels;
+
+					// Colour noise everywhere, only the alpha decides
+					for (size_t channel = 0; channel < in_channels; ++channel)
+					{
+						ptr_pixel[channel] = static_cast<uint8_t>(byte_dist(generator));
+					}
+
+					if (in_channels == 2 || in_channels == 4)
+					{
+						ptr_pixel[in_channels - 1] = in_is_opaque(pos_x, pos_y) ? static_cast<uint8_t>(byte_dist(generator)) : 0;
+					}
+				}
+			}
+
+			fixtures.push_back(std::move(entry));
+		};
+
+		auto in_disc = [](int32_t in_x, int32_t in_y, int32_t in_cx, int32_t in_cy, int32_t in_radius)
+		{ return (in_x - in_cx) * (in_x - in_cx) + (in_y - in_cy) * (in_y - in_cy) <= in_radius * in_radius; };
+
+		add_fixture("disc", 131, 97, 4, true, [&](int32_t in_x, int32_t in_y) { return in_disc(in_x, in_y, 70, 40, 29); });
+		add_fixture("ring", 67, 67, 4, true, [&](int32_t in_x, int32_t in_y) { return in_disc(in_x, in_y, 33, 33, 30) && !in_disc(in_x, in_y, 33, 33, 20); });
+		add_fixture("edges", 129, 33, 2, true, [](int32_t in_x, int32_t in_y) { return in_y == 16 || in_x == 0 || in_x == 128; });
+		add_fixture("pixel", 1, 1, 4, true, [](int32_t, int32_t) { return true; });
+		add_fixture("blobs", 200, 150, 4, false, [&](int32_t in_x, int32_t in_y) { return in_disc(in_x, in_y, 30, 120, 5) || in_disc(in_x, in_y, 170, 20, 3) || (in_x == 99 && in_y == 75); });
+		add_fixture("empty", 65, 17, 4, true, [](int32_t, int32_t) { return false; });
+		add_fixture("opaque", 33, 9, 3, true, [](int32_t, int32_t) { return true; });
+
+		return fixtures;
+	}
+
+	// Every algorithm on a fresh image, the result is cached once scanned, decoded in full and as an alpha plane
+	auto test_bounding_box() -> void
+	{
+		const scratch_dir scratch("bounding_box");
+		png_writer writer(png_encoder::zlib, png_effort::fast);
+
+		for (const auto& entry : make_fixtures())
+		{
+			const auto file_path = scratch.get_file(entry.name + ".png");
+			writer.write(file_path, entry.pixels.data(), entry.width, entry.height, entry.channels);
+
+			const auto expected = get_expected_boundings(entry);
+
+			for (const bool alpha_only : {false, true})
+			{
+				for (uint8_t algorithm = 0; algorithm <= 3; ++algorithm)
+				{
+					if (algorithm == 0 && !entry.is_connected)
+					{
+						continue;
+					}
+
+					image img(file_path);
+					alpha_only ? img.load_alpha() : img.load();
+
+					const auto found = img.get_image_boundings(algorithm);
+					expect(is_same_rect(found, expected), std::format("{}: algorithm {}{} found {}, expected {}", entry.name, algorithm, alpha_only ? " on the alpha plane" : "",
+																	  to_string(found), to_string(expected)));
+				}
+
+				// Bands of rows like the tiles the pipeline splits large images into
+				image img(file_path);
+				alpha_only ? img.load_alpha() : img.load();
+
+				rect tiled;
+				for (int32_t pos_y = 0; pos_y < entry.height; pos_y += 7)
+				{
+					tiled = tiled.get_union(img.grow_boundings(rect{}, pos_y, pos_y + 7));
+				}
+
+				expect(is_same_rect(tiled, expected), std::format("{}: row tiles found {}, expected {}", entry.name, to_string(tiled), to_string(expected)));
+			}
+		}
+	}
+
+	// Smooth gradients with some noise, so every filter gets a row it wins
+	auto make_pixels(int32_t in_width, int32_t in_height, size_t in_channels, std::mt19937& in_generator) -> std::vector<uint8_t>
+	{
+		std::uniform_int_distribution<int32_t> noise_dist(0, 15);
+		std::vector<uint8_t> pixels(static_cast<size_t>(in_width) * static_cast<size_t>(in_height) * in_channels);
+
+		for (int32_t pos_y = 0; pos_y < in_height; ++pos_y)
+		{
+			for (int32_t pos_x = 0; pos_x < in_width; ++pos_x)
+			{
+				for (size_t channel = 0; channel < in_channels; ++channel)
+				{
+					const auto index = (static_cast<size_t>(pos_y) * static_cast<size_t>(in_width) + static_cast<size_t>(pos_x)) * in_channels + channel;
+					pixels[index]	 = static_cast<uint8_t>(pos_x * 3 + pos_y * static_cast<int32_t>(channel + 1) + (pos_y % 5 == 0 ? noise_dist(in_generator) : 0));
+				}
+			}
+		}
+
+		return pixels;
+	}
+
+	// Every encoder and effort writes a file png_reader decodes back to the same pixels, whole and row by row
+	auto test_png_round_trip() -> void
+	{
+		const scratch_dir scratch("png_round_trip");
+		thread_pool pool(4);
+		std::mt19937 generator(seed);
+
+		struct encoder_setup
+		{
+			png_encoder encoder;
+			png_effort effort;
+			bool optimize;
+		};
+
+		const std::array<encoder_setup, 5> setups = {{{png_encoder::stb, png_effort::balanced, false},
+													  {png_encoder::zlib, png_effort::fast, false},
+													  {png_encoder::zlib, png_effort::balanced, false},
+													  {png_encoder::zlib, png_effort::small, false},
+													  {png_encoder::zlib, png_effort::balanced, true}}};
+
+		// The last size is large enough to be deflated in parallel strips
+		const std::array<std::pair<int32_t, int32_t>, 4> sizes = {{{1, 1}, {67, 13}, {131, 70}, {1031, 1100}}};
+
+		for (const auto& setup : setups)
+		{
+			png_writer writer(setup.encoder, setup.effort, &pool);
+			writer.set_optimize(setup.optimize);
+
+			for (const auto& [width, height] : sizes)
+			{
+				// The optimize trials on the largest size only repeat what the strips already cover
+				if (setup.optimize && width > 256)
+				{
+					continue;
+				}
+
+				for (size_t channels = 1; channels <= 4; ++channels)
+				{
+					const auto pixels	 = make_pixels(width, height, channels, generator);
+					const auto file_path = scratch.get_file(std::format("{}x{}x{}.png", width, height, channels));
+					const auto name		 = std::format("{} {}x{}x{}{}", writer.get_encoder_name(), width, height, channels, setup.optimize ? " optimized" : "");
+
+					writer.write(file_path, pixels.data(), width, height, channels);
+
+					const auto decoded = png_reader::decode(file_path);
+					expect(decoded.width == width && decoded.height == height && decoded.channels == channels, name + ": the header changed");
+					expect(decoded.pixels == pixels, name + ": the pixels changed");
+
+					png_reader reader(file_path);
+					const auto stride = reader.get_stride();
+
+					for (int32_t pos_y = 0; pos_y < height; ++pos_y)
+					{
+						const uint8_t* ptr_row = reader.read_row();
+						expect(std::equal(ptr_row, ptr_row + stride, pixels.begin() + static_cast<std::ptrdiff_t>(static_cast<size_t>(pos_y) * stride)),
+							   std::format("{}: row {} changed when read row by row", name, pos_y));
+					}
+				}
+			}
+		}
+	}
+
+	// Pixels widened to RGBA the way the quantizer sees them, every fully transparent pixel is the same colour
+	auto get_rgba(const uint8_t* ptr_pixel, size_t in_channels) -> rgba
+	{
+		rgba color{};
+		switch (in_channels)
+		{
+		case 1:
+			color = {ptr_pixel[0], ptr_pixel[0], ptr_pixel[0], 255};
+			break;
+		case 2:
+			color = {ptr_pixel[0], ptr_pixel[0], ptr_pixel[0], ptr_pixel[1]};
+			break;
+		case 3:
+			color = {ptr_pixel[0], ptr_pixel[1], ptr_pixel[2], 255};
+			break;
+		default:
+			color = {ptr_pixel[0], ptr_pixel[1], ptr_pixel[2], ptr_pixel[3]};
+			break;
+		}
+
+		return color[3] == 0 ? rgba{} : color;
+	}
+
+	// With no more colours than palette entries the palette holds every one of them exactly, in memory and in the written file
+	auto test_quantizer_lossless() -> void
+	{
+		const scratch_dir scratch("quantizer_lossless");
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int32_t> byte_dist(0, 255);
+
+		const quantizer palette_quantizer(256);
+
+		png_writer writer(png_encoder::zlib, png_effort::balanced);
+		writer.set_quantizer(&palette_quantizer);
+
+		constexpr int32_t width	 = 97;
+		constexpr int32_t height = 61;
+
+		for (const size_t channels : {1, 2, 3, 4})
+		{
+			for (const size_t color_count : {1, 2, 17, 255, 256})
+			{
+				// Grey has only 256 values to pick from, so the colours are spread over them instead of drawn
+				std::vector<std::vector<uint8_t>> colors(color_count, std::vector<uint8_t>(channels));
+				for (size_t idx = 0; idx < color_count; ++idx)
+				{
+					std::generate(colors[idx].begin(), colors[idx].end(), [&]() { return static_cast<uint8_t>(byte_dist(generator)); });
+					colors[idx][0] = static_cast<uint8_t>(idx);
+				}
+
+				std::uniform_int_distribution<size_t> color_dist(0, color_count - 1);
+				std::vector<uint8_t> pixels;
+				for (int32_t pixel = 0; pixel < width * height; ++pixel)
+				{
+					const auto& color = colors[color_dist(generator)];
+					pixels.insert(pixels.end(), color.begin(), color.end());
+				}
+
+				const auto name		  = std::format("{} colours of {} channels", color_count, channels);
+				const auto histogram  = quantizer::build_histogram(pixels.data(), pixels.size() / channels, channels);
+				const auto colors_out = palette_quantizer.build_palette(histogram);
+				const auto indices	  = palette_quantizer.remap(pixels.data(), width, height, channels, colors_out);
+
+				expect(colors_out.size() <= palette_quantizer.get_max_colors(), name + ": the palette is too large");
+
+				for (size_t pixel = 0; pixel < indices.size(); ++pixel)
+				{
+					expect(indices[pixel] < colors_out.size() && colors_out[indices[pixel]] == get_rgba(pixels.data() + pixel * channels, channels),
+						   std::format("{}: pixel {} was not mapped to its own colour", name, pixel));
+				}
+
+				// The indexed file decodes back to the same colours, PLTE and tRNS included
+				const auto file_path = scratch.get_file(std::format("{}_{}.png", color_count, channels));
+				expect(writer.write_quantized(file_path, pixels.data(), width, height, channels, std::numeric_limits<size_t>::max()), name + ": the indexed file was not written");
+
+				const auto decoded = decoder_registry::decode(file_path, image_decoder::stb, 4);
+				for (size_t pixel = 0; pixel < indices.size(); ++pixel)
+				{
+					expect(get_rgba(decoded.pixels.data() + pixel * 4, 4) == get_rgba(pixels.data() + pixel * channels, channels),
+						   std::format("{}: pixel {} changed in the indexed file", name, pixel));
+				}
+			}
+		}
+	}
+
+	struct test_case
+	{
+		std::string_view name;
+		void (*run)();
+	};
+
+	constexpr std::array<test_case, 4> test_cases = {{{"alpha_scan", test_alpha_scan},
+													  {"bounding_box", test_bounding_box},
+													  {"png_round_trip", test_png_round_trip},
+													  {"quantizer_lossless", test_quantizer_lossless}}};
+} // namespace
+
+// Runs the cases named on the command line, every case without arguments
+auto main(int32_t argc, char* argv[]) -> int32_t
+{
+	spdlog::set_level(spdlog::level::info);
+
+	std::vector<std::string_view> names(argv + 1, argv + argc);
+	size_t failed = 0;
+	size_t ran	  = 0;
+
+	for (const auto& entry : test_cases)
+	{
+		if (!names.empty() && std::find(names.begin(), names.end(), entry.name) == names.end())
+		{
+			continue;
+		}
+
+		++ran;
+
+		try
+		{
+			entry.run();
+			spdlog::info("Passed: {}", entry.name);
+		}
+		catch (const std::exception& e)
+		{
+			spdlog::error("Failed: {}: {}", entry.name, e.what());
+			++failed;
+		}
+	}
+
+	if (ran == 0)
+	{
+		spdlog::error("No test case matches the given names");
+		return EXIT_FAILURE;
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}